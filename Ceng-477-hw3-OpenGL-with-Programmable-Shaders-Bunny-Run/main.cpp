@@ -1,15 +1,44 @@
+#include <cctype>
+#include <cstdarg>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <new>
 #include <string>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#ifdef __linux__
+#include <cerrno>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#if defined(__GLIBC__)
+#include <execinfo.h>
+#endif
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 #define _USE_MATH_DEFINES
 #include <math.h>
 #ifdef __EMSCRIPTEN__
 #include <emscripten/emscripten.h>
+#include <emscripten/html5.h>
 #include <GLES3/gl3.h>
 #else
 #include <GL/glew.h>
@@ -36,8 +65,255 @@ struct Vertex
 	GLfloat x, y, z;
 };
 GLuint gProgram[5];
+GLuint gBunnyTransformUbo;   // gProgram[0]'s BunnyTransform block
+const GLuint kBunnyTransformBinding = 0;
 static bool gDebugLogs = false;
 
+// ---------------------------------------------------------------------------
+// Allocation tracking
+//
+// The global operator new/delete count every C++ heap allocation per thread.
+// The frame loop and profiling zones take the difference around themselves,
+// so benchmarks report allocations per frame and traces show them per zone.
+// C allocations (malloc in stb, fopen) are not seen. --assert-no-alloc fails
+// a benchmark whose measured frames allocate at all, and prints a backtrace
+// for the first one where glibc allows. Build with -DBUNNY_NO_ALLOC_HOOK to
+// keep the standard operators, e.g. under a sanitizer.
+// ---------------------------------------------------------------------------
+
+struct AllocCounters
+{
+	unsigned long long count;
+	unsigned long long bytes;
+};
+
+// Plain data, so reaching it from operator new never runs a TLS constructor
+static thread_local AllocCounters tAllocs = {0, 0};
+// Nonzero while allocations are bookkeeping rather than the game's; they are
+// neither counted nor trapped then
+static thread_local int tAllocsPaused = 0;
+
+struct AllocGuard
+{
+	bool failOnAlloc = false;   // --assert-no-alloc
+	bool armed = false;         // inside a measured frame
+	bool reported = false;
+	long long violations = 0;   // measured frames that allocated
+};
+static AllocGuard gAllocGuard;
+
+// Last frame's allocations, for the HUD
+static AllocCounters gFrameAllocs = {0, 0};
+
+static void allocTrap(size_t size)
+{
+	if (gAllocGuard.reported)
+		return;
+	gAllocGuard.reported = true;
+	fprintf(stderr, "Allocation of %zu bytes in a steady-state frame\n", size);
+	#if defined(__GLIBC__)
+	void *frames[32];
+	int n = backtrace(frames, 32);
+	backtrace_symbols_fd(frames, n, 2);
+	#endif
+}
+
+#ifndef BUNNY_NO_ALLOC_HOOK
+static inline void *countedAlloc(size_t size)
+{
+	if (tAllocsPaused)
+		return malloc(size ? size : 1);
+	tAllocs.count++;
+	tAllocs.bytes += size;
+	if (gAllocGuard.armed)
+		allocTrap(size);
+	return malloc(size ? size : 1);
+}
+
+void *operator new(size_t size)
+{
+	if (void *p = countedAlloc(size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+	if (void *p = countedAlloc(size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return countedAlloc(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return countedAlloc(size); }
+// Kept out of line: once inlined, GCC pairs free() with the new-expression
+// and warns about a mismatch that does not exist
+__attribute__((noinline)) static void hookFree(void *p)
+{
+	free(p);
+}
+
+void operator delete(void *p) noexcept { hookFree(p); }
+void operator delete[](void *p) noexcept { hookFree(p); }
+void operator delete(void *p, size_t) noexcept { hookFree(p); }
+void operator delete[](void *p, size_t) noexcept { hookFree(p); }
+#endif
+
+// ---------------------------------------------------------------------------
+// CPU profiler
+//
+// PROFILE_SCOPE("name") records a zone from that line to the end of the
+// enclosing block. Zones go into a fixed-size buffer owned by the recording
+// thread, so recording never locks; buffers are linked into a global list
+// with a CAS on first use. --trace <file> enables recording and writes a
+// Chrome/Perfetto trace (chrome://tracing, ui.perfetto.dev) on exit. When
+// disabled a zone costs one predictable branch; building with
+// -DBUNNY_NO_PROFILER removes the zones entirely.
+// ---------------------------------------------------------------------------
+
+struct ProfileEvent
+{
+	const char *name;   // must outlive the profiler; string literals only
+	long long startNs;
+	long long durationNs;
+	int depth;
+	unsigned int allocs;       // C++ heap allocations inside the zone
+	unsigned long long allocBytes;
+};
+
+struct ProfileThreadBuffer
+{
+	static const size_t kCapacity = 1 << 18;
+
+	ProfileEvent events[kCapacity];
+	std::atomic<size_t> count;
+	size_t dropped;
+	int threadId;
+	int depth;
+	const char *threadName;
+	ProfileThreadBuffer *next;
+};
+
+static bool gProfilerEnabled = false;
+static string gTracePath;
+static std::atomic<ProfileThreadBuffer *> gProfileBuffers(NULL);
+static std::atomic<int> gProfileThreadCount(0);
+static thread_local ProfileThreadBuffer *tProfileBuffer = NULL;
+
+static long long profileNowNs()
+{
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static const long long gProfileEpochNs = profileNowNs();
+
+static ProfileThreadBuffer *profileThreadBuffer()
+{
+	if (!tProfileBuffer)
+	{
+		ProfileThreadBuffer *b = new ProfileThreadBuffer;
+		b->count.store(0, std::memory_order_relaxed);
+		b->dropped = 0;
+		b->threadId = gProfileThreadCount.fetch_add(1) + 1;
+		b->depth = 0;
+		b->threadName = b->threadId == 1 ? "main" : NULL;
+		b->next = gProfileBuffers.load(std::memory_order_relaxed);
+		while (!gProfileBuffers.compare_exchange_weak(b->next, b, std::memory_order_release, std::memory_order_relaxed))
+		{
+		}
+		tProfileBuffer = b;
+	}
+	return tProfileBuffer;
+}
+
+// Names the calling thread in the trace
+static void profileSetThreadName(const char *name)
+{
+	if (gProfilerEnabled)
+		profileThreadBuffer()->threadName = name;
+}
+
+struct ProfileScope
+{
+	const char *name;
+	long long startNs;
+	AllocCounters startAllocs;
+
+	explicit ProfileScope(const char *zoneName) : name(NULL)
+	{
+		if (!gProfilerEnabled)
+			return;
+		name = zoneName;
+		profileThreadBuffer()->depth++;
+		startAllocs = tAllocs;
+		startNs = profileNowNs();
+	}
+
+	~ProfileScope()
+	{
+		if (!name)
+			return;
+		long long endNs = profileNowNs();
+		ProfileThreadBuffer *b = tProfileBuffer;
+		b->depth--;
+		size_t n = b->count.load(std::memory_order_relaxed);
+		if (n >= ProfileThreadBuffer::kCapacity)
+		{
+			b->dropped++;
+			return;
+		}
+		ProfileEvent &e = b->events[n];
+		e.name = name;
+		e.startNs = startNs - gProfileEpochNs;
+		e.durationNs = endNs - startNs;
+		e.depth = b->depth;
+		e.allocs = (unsigned int)(tAllocs.count - startAllocs.count);
+		e.allocBytes = tAllocs.bytes - startAllocs.bytes;
+		b->count.store(n + 1, std::memory_order_release);
+	}
+};
+
+#ifdef BUNNY_NO_PROFILER
+#define PROFILE_SCOPE(name)
+#else
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope_, __LINE__)(name)
+#endif
+
+static void writeChromeTrace(const string &fileName)
+{
+	FILE *out = fopen(fileName.c_str(), "w");
+	if (!out)
+	{
+		fprintf(stderr, "Cannot open trace output: %s\n", fileName.c_str());
+		return;
+	}
+
+	fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"bunny-run\"}}");
+	for (ProfileThreadBuffer *b = gProfileBuffers.load(std::memory_order_acquire); b; b = b->next)
+	{
+		if (b->threadName)
+			fprintf(out, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+					b->threadId, b->threadName);
+
+		size_t n = b->count.load(std::memory_order_acquire);
+		for (size_t i = 0; i < n; ++i)
+		{
+			const ProfileEvent &e = b->events[i];
+			fprintf(out, ",\n{\"name\": \"%s\", \"cat\": \"cpu\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+						 "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"depth\": %d, \"allocs\": %u, \"alloc_bytes\": %llu}}",
+					e.name, b->threadId, e.startNs / 1000.0, e.durationNs / 1000.0, e.depth, e.allocs, e.allocBytes);
+		}
+		if (b->dropped)
+			fprintf(stderr, "Profiler: thread %d dropped %zu zones (buffer full)\n", b->threadId, b->dropped);
+	}
+	fprintf(out, "\n]}\n");
+	fclose(out);
+}
+
 
 
 // Define the vertices of the road (two triangles to form a rectangle)
@@ -230,9 +506,10 @@ void main(void)
 
 
 int gWidth, gHeight;
-float leftBound= -4.5f;
-float rightBound= 3.0f;
+const float leftBound= -4.5f;   // bunny x range; read by the event thread too
+const float rightBound= 3.0f;
 float translationX = -0.9f; // Initialize it to 0.0 initially
+float cursorX = -0.9f;       // bunny x of the last cursor move applied
 float rotateX = -90;	   // Initialize it to 0.0 initially
 float rotateZ = 0;	   // Initialize it to 0.0 initially
 float speed= 0.45f;
@@ -321,8 +598,32 @@ vector<Vertex> gVertices2;
 vector<Texture> gTextures2;
 vector<Normal> gNormals2;
 vector<Face> gFaces2;
-int obstacleIndex;
+unsigned long long obstacleKey = 0;   // obstacle stream of the current game
 int score=0;
+float scoreCarry = 0;        // part of a point earned in steps shorter than 1/60 s
+unsigned inputApplied = 0;   // input events the simulation has acted on
+
+// Scene size. The game uses the defaults; the stress mode scales them.
+int gLaneCount = 4;
+int gTileCount = 30;
+int gObstacleRowStride = 0;   // 0 = one obstacle row, at tile 15
+int gBunnyCopies = 1;         // tiled copies of bunny.obj in the bunny VBO
+int gBunnySubdivisions = 0;   // 1-to-4 triangle splits applied to bunny.obj
+float gRoadSpeedScale = 1;    // multiplies the road's per-tick speed-up
+bool gPreciseCollision = false;   // refine collision boxes to bunny.obj's triangles
+int gBackgroundLayers = 1;    // full-screen background overdraw
+
+float trackLength()
+{
+	return 2.0f * gTileCount;
+}
+
+bool isObstacleRow(int tile)
+{
+	if (gObstacleRowStride <= 0)
+		return tile == 15;
+	return tile % gObstacleRowStride == 15 % gObstacleRowStride;
+}
 GLuint gVertexAttribBuffer, gIndexBuffer;
 GLint gInVertexLoc, gInNormalLoc;
 int gVertexDataSizeInBytes, gNormalDataSizeInBytes;
@@ -331,6 +632,164 @@ GLuint gVertexAttribBuffer2, gIndexBuffer2;
 GLint gInVertexLoc2, gInNormalLoc2;
 GLuint vao, vao2;
 
+// ---------------------------------------------------------------------------
+// Renderer statistics
+//
+// The draw path goes through the stat* wrappers below, which count what is
+// submitted before calling GL. Counters are reset at the start of every frame
+// and kept for the last kWindow frames so the benchmark and the HUD can read
+// per-frame and rolling values.
+// ---------------------------------------------------------------------------
+
+enum RenderStat
+{
+	STAT_DRAW_CALLS,
+	STAT_TRIANGLES,
+	STAT_PROGRAM_SWITCHES,
+	STAT_VAO_BINDS,
+	STAT_BUFFER_BINDS,
+	STAT_UNIFORM_UPLOADS,
+	STAT_TEXTURE_BINDS,
+	STAT_BYTES_UPLOADED,    // buffer, texture and uniform data
+	STAT_COUNT
+};
+
+const char *kRenderStatNames[STAT_COUNT] = {"draw_calls", "triangles", "program_switches", "vao_binds",
+											"buffer_binds", "uniform_uploads", "texture_binds", "bytes_uploaded"};
+
+struct RenderStats
+{
+	static const int kWindow = 240;
+
+	long long frame[STAT_COUNT] = {};          // frame being submitted
+	long long last[STAT_COUNT] = {};           // last completed frame
+	long long history[kWindow][STAT_COUNT] = {};
+	int historyHead = 0;
+	int historyCount = 0;
+
+	GLuint program = 0;     // last program, so only real switches count
+};
+
+RenderStats gRenderStats;
+
+void renderStatsBeginFrame()
+{
+	memset(gRenderStats.frame, 0, sizeof(gRenderStats.frame));
+}
+
+void renderStatsEndFrame()
+{
+	memcpy(gRenderStats.last, gRenderStats.frame, sizeof(gRenderStats.frame));
+	memcpy(gRenderStats.history[gRenderStats.historyHead], gRenderStats.frame, sizeof(gRenderStats.frame));
+	gRenderStats.historyHead = (gRenderStats.historyHead + 1) % RenderStats::kWindow;
+	gRenderStats.historyCount = std::min(gRenderStats.historyCount + 1, RenderStats::kWindow);
+}
+
+// Mean and max of one counter over the rolling window
+void renderStatsRolling(RenderStat stat, double &mean, long long &max)
+{
+	mean = 0.0;
+	max = 0;
+	for (int i = 0; i < gRenderStats.historyCount; ++i)
+	{
+		long long v = gRenderStats.history[i][stat];
+		mean += v;
+		max = std::max(max, v);
+	}
+	if (gRenderStats.historyCount > 0)
+		mean /= gRenderStats.historyCount;
+}
+
+inline void statUseProgram(GLuint program)
+{
+	if (program != gRenderStats.program)
+	{
+		gRenderStats.frame[STAT_PROGRAM_SWITCHES]++;
+		gRenderStats.program = program;
+	}
+	glUseProgram(program);
+}
+
+inline void statBindVertexArray(GLuint array)
+{
+	gRenderStats.frame[STAT_VAO_BINDS]++;
+	glBindVertexArray(array);
+}
+
+inline void statBindBuffer(GLenum target, GLuint buffer)
+{
+	gRenderStats.frame[STAT_BUFFER_BINDS]++;
+	glBindBuffer(target, buffer);
+}
+
+inline void statBindTexture(GLenum target, GLuint texture)
+{
+	gRenderStats.frame[STAT_TEXTURE_BINDS]++;
+	glBindTexture(target, texture);
+}
+
+inline void statBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+{
+	if (data)
+		gRenderStats.frame[STAT_BYTES_UPLOADED] += size;
+	glBufferData(target, size, data, usage);
+}
+
+inline void statBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data)
+{
+	gRenderStats.frame[STAT_BYTES_UPLOADED] += size;
+	glBufferSubData(target, offset, size, data);
+}
+
+inline void statUniformMatrix4fv(GLint location, const glm::mat4 &m)
+{
+	gRenderStats.frame[STAT_UNIFORM_UPLOADS]++;
+	gRenderStats.frame[STAT_BYTES_UPLOADED] += sizeof(m);
+	glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(m));
+}
+
+inline void statUniformMatrix4fv(GLint location, const float *m)
+{
+	gRenderStats.frame[STAT_UNIFORM_UPLOADS]++;
+	gRenderStats.frame[STAT_BYTES_UPLOADED] += 16 * sizeof(float);
+	glUniformMatrix4fv(location, 1, GL_FALSE, m);
+}
+
+inline void statUniform3fv(GLint location, const glm::vec3 &v)
+{
+	gRenderStats.frame[STAT_UNIFORM_UPLOADS]++;
+	gRenderStats.frame[STAT_BYTES_UPLOADED] += sizeof(v);
+	glUniform3fv(location, 1, glm::value_ptr(v));
+}
+
+inline void statUniform2f(GLint location, GLfloat x, GLfloat y)
+{
+	gRenderStats.frame[STAT_UNIFORM_UPLOADS]++;
+	gRenderStats.frame[STAT_BYTES_UPLOADED] += 2 * sizeof(GLfloat);
+	glUniform2f(location, x, y);
+}
+
+inline void statUniform1i(GLint location, GLint v)
+{
+	gRenderStats.frame[STAT_UNIFORM_UPLOADS]++;
+	gRenderStats.frame[STAT_BYTES_UPLOADED] += sizeof(v);
+	glUniform1i(location, v);
+}
+
+inline void statDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	gRenderStats.frame[STAT_DRAW_CALLS]++;
+	gRenderStats.frame[STAT_TRIANGLES] += count / 3;
+	glDrawArrays(mode, first, count);
+}
+
+inline void statDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices)
+{
+	gRenderStats.frame[STAT_DRAW_CALLS]++;
+	gRenderStats.frame[STAT_TRIANGLES] += count / 3;
+	glDrawElements(mode, count, type, indices);
+}
+
 const char* getGLErrorString(GLenum error) {
     switch (error) {
         case GL_NO_ERROR:
@@ -350,13 +809,149 @@ const char* getGLErrorString(GLenum error) {
     }
 }
 
-void checkGLError(string here) {
-    if (!gDebugLogs) return;
+// ---------------------------------------------------------------------------
+// GL error checking
+//
+// GL_CHECK("label") polls glGetError after a group of calls. It compiles to
+// nothing with -DNDEBUG or -DBUNNY_NO_GL_CHECKS, and at run time only polls
+// under --debug. With --gl-debug a KHR_debug callback reports errors and
+// driver warnings instead, and the polling is skipped.
+// ---------------------------------------------------------------------------
+
+struct GLDebugState
+{
+	bool requested = false;   // --gl-debug or --gl-debug-sync
+	bool sync = false;        // report from inside the offending call
+	int minSeverity = 2;      // index into kGLDebugSeverityNames
+	bool active = false;      // callback installed
+
+	// Last GL_CHECK reached, so synchronous messages can name a call site
+	const char *lastLabel = "startup";
+	const char *lastFile = __FILE__;
+	int lastLine = 0;
+};
+
+GLDebugState gGLDebug;
+
+void checkGLError(const char *here, const char *file, int line) {
+    gGLDebug.lastLabel = here;
+    gGLDebug.lastFile = file;
+    gGLDebug.lastLine = line;
+    if (!gDebugLogs || gGLDebug.active) return;
     while (GLenum error = glGetError()) {
-        std::cerr << "OpenGL Error: " << getGLErrorString(error) << here << std::endl;
+        std::cerr << "OpenGL Error: " << getGLErrorString(error) << " at " << here
+                  << " (" << file << ":" << line << ")" << std::endl;
     }
 }
 
+#if defined(NDEBUG) || defined(BUNNY_NO_GL_CHECKS)
+#define GL_CHECK(here) ((void)0)
+#else
+#define GL_CHECK(here) checkGLError(here, __FILE__, __LINE__)
+#endif
+
+const char *kGLDebugSeverityNames[] = {"notification", "low", "medium", "high"};
+
+static bool parseGLDebugSeverity(const string &name, int &rank)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		if (name == kGLDebugSeverityNames[i])
+		{
+			rank = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+#ifndef __EMSCRIPTEN__
+static int glDebugSeverityRank(GLenum severity)
+{
+	switch (severity)
+	{
+	case GL_DEBUG_SEVERITY_HIGH: return 3;
+	case GL_DEBUG_SEVERITY_MEDIUM: return 2;
+	case GL_DEBUG_SEVERITY_LOW: return 1;
+	default: return 0;
+	}
+}
+
+static const char *glDebugSourceString(GLenum source)
+{
+	switch (source)
+	{
+	case GL_DEBUG_SOURCE_API: return "api";
+	case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "window-system";
+	case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader-compiler";
+	case GL_DEBUG_SOURCE_THIRD_PARTY: return "third-party";
+	case GL_DEBUG_SOURCE_APPLICATION: return "application";
+	default: return "other";
+	}
+}
+
+static const char *glDebugTypeString(GLenum type)
+{
+	switch (type)
+	{
+	case GL_DEBUG_TYPE_ERROR: return "error";
+	case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+	case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "undefined";
+	case GL_DEBUG_TYPE_PORTABILITY: return "portability";
+	case GL_DEBUG_TYPE_PERFORMANCE: return "performance";
+	case GL_DEBUG_TYPE_MARKER: return "marker";
+	default: return "other";
+	}
+}
+
+static void GLAPIENTRY glDebugCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
+									   GLsizei length, const GLchar *message, const void *userParam)
+{
+	// Drivers may ignore glDebugMessageControl for some messages
+	if (glDebugSeverityRank(severity) < gGLDebug.minSeverity)
+		return;
+
+	fprintf(stderr, "GL %s %s %s #%u: %.*s", kGLDebugSeverityNames[glDebugSeverityRank(severity)], glDebugSourceString(source),
+			glDebugTypeString(type), id, (int)length, message);
+	// Only in synchronous mode is the last check point known to precede the call
+	if (gGLDebug.sync)
+		fprintf(stderr, " (after %s, %s:%d)", gGLDebug.lastLabel, gGLDebug.lastFile, gGLDebug.lastLine);
+	fputc('\n', stderr);
+}
+#endif
+
+// Installs the KHR_debug callback. Needs a debug context (see main) and GL 4.3
+// or KHR_debug; WebGL has neither, so the web build keeps GL_CHECK polling.
+void glDebugInit()
+{
+	#ifdef __EMSCRIPTEN__
+	if (gDebugLogs) fprintf(stderr, "KHR_debug is not available in WebGL; using glGetError\n");
+	#else
+	if (!GLEW_VERSION_4_3 && !GLEW_KHR_debug)
+	{
+		if (gDebugLogs) fprintf(stderr, "KHR_debug is not available; using glGetError\n");
+		return;
+	}
+
+	glEnable(GL_DEBUG_OUTPUT);
+	if (gGLDebug.sync)
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	else
+		glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	glDebugMessageCallback(glDebugCallback, NULL);
+
+	// Filter in the driver so dropped messages are never formatted
+	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_TRUE);
+	static const GLenum kSeverities[] = {GL_DEBUG_SEVERITY_NOTIFICATION, GL_DEBUG_SEVERITY_LOW,
+										 GL_DEBUG_SEVERITY_MEDIUM, GL_DEBUG_SEVERITY_HIGH};
+	for (GLenum severity : kSeverities)
+		if (glDebugSeverityRank(severity) < gGLDebug.minSeverity)
+			glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, severity, 0, NULL, GL_FALSE);
+
+	gGLDebug.active = true;
+	#endif
+}
+
 void checkShaderCompilation(GLuint shader) {
     GLint success;
     GLchar infoLog[1024];
@@ -597,7 +1192,7 @@ void initBackground() {
     glGenBuffers(1, &bgVBO);
     glBindVertexArray(bgVAO);
     glBindBuffer(GL_ARRAY_BUFFER, bgVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(bgVertices), bgVertices, GL_STATIC_DRAW);
+    statBufferData(GL_ARRAY_BUFFER, sizeof(bgVertices), bgVertices, GL_STATIC_DRAW);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
@@ -609,6 +1204,7 @@ void initBackground() {
 
 
 GLuint loadTexture(const char* path) {
+    PROFILE_SCOPE("loadTexture");
     GLuint textureID;
     int width, height, nrChannels;
     unsigned char *data = stbi_load(path, &width, &height, &nrChannels, 0);
@@ -624,6 +1220,7 @@ GLuint loadTexture(const char* path) {
         glGenTextures(1, &textureID);
         glBindTexture(GL_TEXTURE_2D, textureID);
         glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        gRenderStats.frame[STAT_BYTES_UPLOADED] += (long long)width * height * nrChannels;
         glGenerateMipmap(GL_TEXTURE_2D);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -645,6 +1242,7 @@ vector<Texture> &gTextures,
 vector<Normal> &gNormals,
 vector<Face> &gFaces)
 {
+	PROFILE_SCOPE("ParseObj");
 	fstream myfile;
 
 	// Open the input
@@ -740,6 +1338,7 @@ vector<Face> &gFaces)
 
 void initShaders()
 {
+	PROFILE_SCOPE("initShaders");
 	// Create the programs
 
 	gProgram[0] = glCreateProgram();
@@ -835,6 +1434,14 @@ void initShaders()
 	}
 
 
+	// The bunny's transform lives in a small uniform buffer written right
+	// before its draw, so --low-latency can latch it as late as possible
+	glUniformBlockBinding(gProgram[0], glGetUniformBlockIndex(gProgram[0], "BunnyTransform"), kBunnyTransformBinding);
+	glGenBuffers(1, &gBunnyTransformUbo);
+	glBindBuffer(GL_UNIFORM_BUFFER, gBunnyTransformUbo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, kBunnyTransformBinding, gBunnyTransformUbo);
+
 	// Get the locations of the uniform variables from both programs
 
 	for (int i = 0; i < 5; ++i)
@@ -852,11 +1459,70 @@ void initShaders()
     glDeleteShader(fs2);
 }
 
+struct MeshBounds
+{
+	float minX, maxX;
+	float minY, maxY;
+	float minZ, maxZ;
+};
+
+// Object-space bounds of bunny.obj and cube.obj for collision; a unit cube
+// until init() has loaded the meshes
+MeshBounds gBunnyBounds = {-1, 1, -1, 1, -1, 1};
+MeshBounds gObstacleBounds = {-1, 1, -1, 1, -1, 1};
+
+MeshBounds meshBounds(const vector<Vertex> &vertices)
+{
+	MeshBounds b = {1e6, -1e6, 1e6, -1e6, 1e6, -1e6};
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		b.minX = std::min(b.minX, vertices[i].x);
+		b.maxX = std::max(b.maxX, vertices[i].x);
+		b.minY = std::min(b.minY, vertices[i].y);
+		b.maxY = std::max(b.maxY, vertices[i].y);
+		b.minZ = std::min(b.minZ, vertices[i].z);
+		b.maxZ = std::max(b.maxZ, vertices[i].z);
+	}
+	return b;
+}
+
+// Flattens the parsed mesh into the tightly packed arrays initVBO() uploads
+// and returns the object-space bounds of the vertices.
+MeshBounds PackMeshData(const vector<Vertex> &gVertices,
+const vector<Normal> &gNormals,
+const vector<Face> &gFaces,
+GLfloat *vertexData, GLfloat *normalData, GLuint *indexData)
+{
+	for (int i = 0; i < gVertices.size(); ++i)
+	{
+		vertexData[3 * i] = gVertices[i].x;
+		vertexData[3 * i + 1] = gVertices[i].y;
+		vertexData[3 * i + 2] = gVertices[i].z;
+	}
+
+	for (int i = 0; i < gNormals.size(); ++i)
+	{
+		normalData[3 * i] = gNormals[i].x;
+		normalData[3 * i + 1] = gNormals[i].y;
+		normalData[3 * i + 2] = gNormals[i].z;
+	}
+
+	for (int i = 0; i < gFaces.size(); ++i)
+	{
+		indexData[3 * i] = gFaces[i].vIndex[0];
+		indexData[3 * i + 1] = gFaces[i].vIndex[1];
+		indexData[3 * i + 2] = gFaces[i].vIndex[2];
+	}
+
+	return meshBounds(gVertices);
+}
+
 void initVBO(GLuint &vao, GLuint &gVertexAttribBuffer, GLuint &gIndexBuffer, int &gVertexDataSizeInBytes, int &gNormalDataSizeInBytes, vector<Vertex> &gVertices,
 vector<Texture> &gTextures,
 vector<Normal> &gNormals,
 vector<Face> &gFaces)
 {
+	PROFILE_SCOPE("initVBO");
 	glGenVertexArrays(1, &vao);
 	assert(vao > 0);
 	glBindVertexArray(vao);
@@ -881,51 +1547,21 @@ vector<Face> &gFaces)
 	GLfloat *normalData = new GLfloat[gNormals.size() * 3];
 	GLuint *indexData = new GLuint[gFaces.size() * 3];
 
-	float minX = 1e6, maxX = -1e6;
-	float minY = 1e6, maxY = -1e6;
-	float minZ = 1e6, maxZ = -1e6;
-
-	for (int i = 0; i < gVertices.size(); ++i)
-	{
-		vertexData[3 * i] = gVertices[i].x;
-		vertexData[3 * i + 1] = gVertices[i].y;
-		vertexData[3 * i + 2] = gVertices[i].z;
-
-		minX = std::min(minX, gVertices[i].x);
-		maxX = std::max(maxX, gVertices[i].x);
-		minY = std::min(minY, gVertices[i].y);
-		maxY = std::max(maxY, gVertices[i].y);
-		minZ = std::min(minZ, gVertices[i].z);
-		maxZ = std::max(maxZ, gVertices[i].z);
-	}
+	MeshBounds bounds = PackMeshData(gVertices, gNormals, gFaces, vertexData, normalData, indexData);
 
 	if (gDebugLogs) {
-		std::cout << "minX = " << minX << std::endl;
-		std::cout << "maxX = " << maxX << std::endl;
-		std::cout << "minY = " << minY << std::endl;
-		std::cout << "maxY = " << maxY << std::endl;
-		std::cout << "minZ = " << minZ << std::endl;
-		std::cout << "maxZ = " << maxZ << std::endl;
-	}
-
-	for (int i = 0; i < gNormals.size(); ++i)
-	{
-		normalData[3 * i] = gNormals[i].x;
-		normalData[3 * i + 1] = gNormals[i].y;
-		normalData[3 * i + 2] = gNormals[i].z;
-	}
-
-	for (int i = 0; i < gFaces.size(); ++i)
-	{
-		indexData[3 * i] = gFaces[i].vIndex[0];
-		indexData[3 * i + 1] = gFaces[i].vIndex[1];
-		indexData[3 * i + 2] = gFaces[i].vIndex[2];
+		std::cout << "minX = " << bounds.minX << std::endl;
+		std::cout << "maxX = " << bounds.maxX << std::endl;
+		std::cout << "minY = " << bounds.minY << std::endl;
+		std::cout << "maxY = " << bounds.maxY << std::endl;
+		std::cout << "minZ = " << bounds.minZ << std::endl;
+		std::cout << "maxZ = " << bounds.maxZ << std::endl;
 	}
 
-	glBufferData(GL_ARRAY_BUFFER, gVertexDataSizeInBytes + gNormalDataSizeInBytes, 0, GL_STATIC_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, gVertexDataSizeInBytes, vertexData);
-	glBufferSubData(GL_ARRAY_BUFFER, gVertexDataSizeInBytes, gNormalDataSizeInBytes, normalData);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexDataSizeInBytes, indexData, GL_STATIC_DRAW);
+	statBufferData(GL_ARRAY_BUFFER, gVertexDataSizeInBytes + gNormalDataSizeInBytes, 0, GL_STATIC_DRAW);
+	statBufferSubData(GL_ARRAY_BUFFER, 0, gVertexDataSizeInBytes, vertexData);
+	statBufferSubData(GL_ARRAY_BUFFER, gVertexDataSizeInBytes, gNormalDataSizeInBytes, normalData);
+	statBufferData(GL_ELEMENT_ARRAY_BUFFER, indexDataSizeInBytes, indexData, GL_STATIC_DRAW);
 
 	// done copying to GPU memory; can free now from CPU memory
 	delete[] vertexData;
@@ -937,17 +1573,127 @@ vector<Face> &gFaces)
 }
 
 
-void init()
+vector<Vertex> gBaseVertices;
+vector<Normal> gBaseNormals;
+vector<Face> gBaseFaces;
+
+// Replaces the bunny mesh with gBunnyCopies tiled copies of bunny.obj, each
+// triangle split into four gBunnySubdivisions times. Used to scale vertex load
+// in the stress mode; with the defaults the mesh is bunny.obj unchanged.
+void expandBunnyMesh()
 {
+	if (gBaseVertices.empty())
+	{
+		gBaseVertices = gVertices;
+		gBaseNormals = gNormals;
+		gBaseFaces = gFaces;
+	}
 
-    ParseObj("bunny.obj", gVertices,gTextures,gNormals,gFaces);
-    glEnable(GL_DEPTH_TEST);
+	vector<Vertex> verts = gBaseVertices;
+	vector<Normal> norms = gBaseNormals;
+	vector<Face> faces = gBaseFaces;
 
-    initVBO(vao, gVertexAttribBuffer, gIndexBuffer, gVertexDataSizeInBytes,gNormalDataSizeInBytes, gVertices,gTextures,gNormals,gFaces);
-    glDisable(GL_DEPTH_TEST);
+	for (int level = 0; level < gBunnySubdivisions; ++level)
+	{
+		vector<Face> split;
+		split.reserve(faces.size() * 4);
+		for (size_t f = 0; f < faces.size(); ++f)
+		{
+			int corner[3], mid[3];
+			for (int k = 0; k < 3; ++k)
+				corner[k] = faces[f].vIndex[k];
 
-    ParseObj("cube.obj", gVertices2,gTextures2,gNormals2,gFaces2);
-    glEnable(GL_DEPTH_TEST);
+			// Midpoints are not shared between faces; that is fine for load testing
+			for (int k = 0; k < 3; ++k)
+			{
+				const Vertex &a = verts[corner[k]];
+				const Vertex &b = verts[corner[(k + 1) % 3]];
+				const Normal &na = norms[corner[k]];
+				const Normal &nb = norms[corner[(k + 1) % 3]];
+				glm::vec3 n = glm::normalize(glm::vec3(na.x + nb.x, na.y + nb.y, na.z + nb.z) + glm::vec3(1e-6f));
+				mid[k] = verts.size();
+				verts.push_back(Vertex((a.x + b.x) * 0.5f, (a.y + b.y) * 0.5f, (a.z + b.z) * 0.5f));
+				norms.push_back(Normal(n.x, n.y, n.z));
+			}
+
+			int tri[4][3] = {{corner[0], mid[0], mid[2]},
+							 {mid[0], corner[1], mid[1]},
+							 {mid[2], mid[1], corner[2]},
+							 {mid[0], mid[1], mid[2]}};
+			for (int t = 0; t < 4; ++t)
+				split.push_back(Face(tri[t], tri[t], tri[t]));
+		}
+		faces.swap(split);
+	}
+
+	gVertices.clear();
+	gNormals.clear();
+	gFaces.clear();
+
+	float minX = 1e6, maxX = -1e6, minZ = 1e6, maxZ = -1e6;
+	for (size_t v = 0; v < verts.size(); ++v)
+	{
+		minX = std::min(minX, verts[v].x);
+		maxX = std::max(maxX, verts[v].x);
+		minZ = std::min(minZ, verts[v].z);
+		maxZ = std::max(maxZ, verts[v].z);
+	}
+
+	int side = (int)ceil(sqrt((double)gBunnyCopies));
+	for (int c = 0; c < gBunnyCopies; ++c)
+	{
+		float dx = (c % side) * (maxX - minX) * 1.1f;
+		float dz = (c / side) * (maxZ - minZ) * 1.1f;
+		int base = gVertices.size();
+		for (size_t v = 0; v < verts.size(); ++v)
+		{
+			gVertices.push_back(Vertex(verts[v].x + dx, verts[v].y, verts[v].z - dz));
+			gNormals.push_back(norms[v]);
+		}
+		for (size_t f = 0; f < faces.size(); ++f)
+		{
+			int idx[3];
+			for (int k = 0; k < 3; ++k)
+				idx[k] = faces[f].vIndex[k] + base;
+			gFaces.push_back(Face(idx, idx, idx));
+		}
+	}
+}
+
+// Re-uploads the bunny after gBunnyCopies or gBunnySubdivisions changed
+void rebuildBunnyMesh()
+{
+	glDeleteBuffers(1, &gVertexAttribBuffer);
+	glDeleteBuffers(1, &gIndexBuffer);
+	glDeleteVertexArrays(1, &vao);
+
+	expandBunnyMesh();
+	initVBO(vao, gVertexAttribBuffer, gIndexBuffer, gVertexDataSizeInBytes, gNormalDataSizeInBytes, gVertices, gTextures, gNormals, gFaces);
+	glBindVertexArray(0);
+}
+
+void bunnyBvhBuild();
+
+void init()
+{
+    PROFILE_SCOPE("init");
+
+    ParseObj("bunny.obj", gVertices,gTextures,gNormals,gFaces);
+    if (!gVertices.empty())
+        gBunnyBounds = meshBounds(gVertices);   // one bunny, before any stress copies
+    if (gPreciseCollision)
+        bunnyBvhBuild();
+    if (gBunnyCopies > 1 || gBunnySubdivisions > 0)
+        expandBunnyMesh();
+    glEnable(GL_DEPTH_TEST);
+
+    initVBO(vao, gVertexAttribBuffer, gIndexBuffer, gVertexDataSizeInBytes,gNormalDataSizeInBytes, gVertices,gTextures,gNormals,gFaces);
+    glDisable(GL_DEPTH_TEST);
+
+    ParseObj("cube.obj", gVertices2,gTextures2,gNormals2,gFaces2);
+    if (!gVertices2.empty())
+        gObstacleBounds = meshBounds(gVertices2);
+    glEnable(GL_DEPTH_TEST);
     initVBO(vao2,gVertexAttribBuffer2, gIndexBuffer2,gVertexDataSizeInBytes2,gNormalDataSizeInBytes2, gVertices2,gTextures2,gNormals2,gFaces2);
 
     initBackground();        // Initialize background VAO/VBO
@@ -958,339 +1704,4333 @@ void init()
 
 void drawModel() {
 
-    glBindVertexArray(gVertexAttribBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, gVertexAttribBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gIndexBuffer);
+    // The VAO from initVBO() already holds the buffers and attribute layout
+    statBindVertexArray(vao);
+
+    statDrawElements(GL_TRIANGLES, gFaces.size() * 3, GL_UNSIGNED_INT, 0);
+}
+
+void drawModel2() {
+
+    // The VAO from initVBO() already holds the buffers and attribute layout
+    statBindVertexArray(vao2);
+
+    statDrawElements(GL_TRIANGLES, gFaces2.size() * 3, GL_UNSIGNED_INT, 0);
+}
+
+// ---------------------------------------------------------------------------
+// GPU pass timers
+//
+// Each pass of display() is wrapped in a GL_TIME_ELAPSED query. Queries for a
+// frame are read kLatency frames later, when the GPU has long finished them,
+// so timing never stalls the pipeline; a result that is still not ready is
+// dropped rather than waited for. On WebGL this needs
+// EXT_disjoint_timer_query_webgl2, and frames flagged as disjoint are
+// discarded.
+// ---------------------------------------------------------------------------
+
+#ifdef __EMSCRIPTEN__
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+#define GPU_TIMER_QUERY GL_TIME_ELAPSED_EXT
+#else
+#define GPU_TIMER_QUERY GL_TIME_ELAPSED
+#endif
+
+enum GpuPass
+{
+	GPU_PASS_BACKGROUND,
+	GPU_PASS_BUNNY,
+	GPU_PASS_ROAD,
+	GPU_PASS_OBSTACLES,
+	GPU_PASS_HUD,
+	GPU_PASS_COUNT
+};
+
+const char *kGpuPassNames[GPU_PASS_COUNT] = {"background", "bunny", "road", "obstacles", "hud"};
+
+struct GpuTimerState
+{
+	static const int kLatency = 4;    // frames between issuing and reading a query
+	static const int kWindow = 240;   // frames kept for rolling statistics
+
+	bool requested = false;   // --gpu-timers, --gpu-csv or a benchmark
+	bool initialized = false; // the HUD may also start the timers
+	bool enabled = false;
+	GLuint queries[kLatency][GPU_PASS_COUNT];
+	unsigned int issuedMask[kLatency];  // passes begun in that slot's frame
+	bool pending[kLatency];
+	bool record[kLatency];              // frame counts towards the benchmark
+	int slotFrame[kLatency];
+	int frame = 0;
+	int activePass = -1;
+
+	// Rolling window of resolved frames; index GPU_PASS_COUNT is the total
+	float history[GPU_PASS_COUNT + 1][kWindow];
+	int historyCount = 0;
+	int historyHead = 0;
+	int droppedFrames = 0;
+
+	string csvPath;
+	FILE *csv = NULL;
+};
+GpuTimerState gGpuTimer;
+
+// Called for every resolved frame; the benchmark collects its samples here
+void onGpuFrameTimed(bool record, const float passMs[GPU_PASS_COUNT], float totalMs);
+
+void gpuTimerInit()
+{
+	if (gGpuTimer.initialized)
+		return;
+	gGpuTimer.initialized = true;
+
+	#ifdef __EMSCRIPTEN__
+	EMSCRIPTEN_WEBGL_CONTEXT_HANDLE context = emscripten_webgl_get_current_context();
+	if (!emscripten_webgl_enable_extension(context, "EXT_disjoint_timer_query_webgl2"))
+	{
+		if (gDebugLogs) std::cerr << "EXT_disjoint_timer_query_webgl2 unavailable; GPU timers disabled" << std::endl;
+		gGpuTimer.enabled = false;
+		return;
+	}
+	#endif
+
+	glGenQueries(GpuTimerState::kLatency * GPU_PASS_COUNT, &gGpuTimer.queries[0][0]);
+	for (int i = 0; i < GpuTimerState::kLatency; ++i)
+	{
+		gGpuTimer.pending[i] = false;
+		gGpuTimer.record[i] = false;
+		gGpuTimer.issuedMask[i] = 0;
+	}
+	gGpuTimer.enabled = glGetError() == GL_NO_ERROR;
+
+	if (gGpuTimer.enabled && !gGpuTimer.csvPath.empty())
+	{
+		gGpuTimer.csv = fopen(gGpuTimer.csvPath.c_str(), "w");
+		if (gGpuTimer.csv)
+		{
+			fprintf(gGpuTimer.csv, "frame");
+			for (int p = 0; p < GPU_PASS_COUNT; ++p)
+				fprintf(gGpuTimer.csv, ",%s_ms", kGpuPassNames[p]);
+			fprintf(gGpuTimer.csv, ",total_ms\n");
+		}
+	}
+}
+
+static void gpuTimerResolve(int slot, bool wait)
+{
+	if (!gGpuTimer.pending[slot])
+		return;
+
+	unsigned int mask = gGpuTimer.issuedMask[slot];
+	for (int p = 0; p < GPU_PASS_COUNT && !wait; ++p)
+	{
+		if (!(mask & (1u << p)))
+			continue;
+		GLuint available = 0;
+		glGetQueryObjectuiv(gGpuTimer.queries[slot][p], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+		{
+			gGpuTimer.pending[slot] = false;
+			gGpuTimer.droppedFrames++;
+			return;
+		}
+	}
+
+	float passMs[GPU_PASS_COUNT];
+	float totalMs = 0.0f;
+	for (int p = 0; p < GPU_PASS_COUNT; ++p)
+	{
+		passMs[p] = 0.0f;
+		if (!(mask & (1u << p)))
+			continue;
+		#ifdef __EMSCRIPTEN__
+		GLuint elapsedNs = 0;
+		glGetQueryObjectuiv(gGpuTimer.queries[slot][p], GL_QUERY_RESULT, &elapsedNs);
+		#else
+		GLuint64 elapsedNs = 0;
+		glGetQueryObjectui64v(gGpuTimer.queries[slot][p], GL_QUERY_RESULT, &elapsedNs);
+		#endif
+		passMs[p] = elapsedNs / 1.0e6f;
+		totalMs += passMs[p];
+	}
+	gGpuTimer.pending[slot] = false;
+
+	#ifdef __EMSCRIPTEN__
+	// A disjoint event (power state change, context loss) invalidates timings
+	GLint disjoint = 0;
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+	if (disjoint)
+	{
+		gGpuTimer.droppedFrames++;
+		return;
+	}
+	#endif
+
+	int head = gGpuTimer.historyHead;
+	for (int p = 0; p < GPU_PASS_COUNT; ++p)
+		gGpuTimer.history[p][head] = passMs[p];
+	gGpuTimer.history[GPU_PASS_COUNT][head] = totalMs;
+	gGpuTimer.historyHead = (head + 1) % GpuTimerState::kWindow;
+	gGpuTimer.historyCount = std::min(gGpuTimer.historyCount + 1, GpuTimerState::kWindow);
+
+	if (gGpuTimer.csv)
+	{
+		fprintf(gGpuTimer.csv, "%d", gGpuTimer.slotFrame[slot]);
+		for (int p = 0; p < GPU_PASS_COUNT; ++p)
+			fprintf(gGpuTimer.csv, ",%.4f", passMs[p]);
+		fprintf(gGpuTimer.csv, ",%.4f\n", totalMs);
+	}
+
+	onGpuFrameTimed(gGpuTimer.record[slot], passMs, totalMs);
+}
+
+void gpuTimerBeginFrame(bool record)
+{
+	if (!gGpuTimer.enabled)
+		return;
+
+	int slot = gGpuTimer.frame % GpuTimerState::kLatency;
+	gpuTimerResolve(slot, false);
+	gGpuTimer.issuedMask[slot] = 0;
+	gGpuTimer.record[slot] = record;
+	gGpuTimer.slotFrame[slot] = gGpuTimer.frame;
+}
+
+void gpuPassBegin(GpuPass pass)
+{
+	if (!gGpuTimer.enabled)
+		return;
+
+	int slot = gGpuTimer.frame % GpuTimerState::kLatency;
+	glBeginQuery(GPU_TIMER_QUERY, gGpuTimer.queries[slot][pass]);
+	gGpuTimer.issuedMask[slot] |= 1u << pass;
+	gGpuTimer.activePass = pass;
+}
+
+void gpuPassEnd()
+{
+	if (!gGpuTimer.enabled || gGpuTimer.activePass < 0)
+		return;
+
+	glEndQuery(GPU_TIMER_QUERY);
+	gGpuTimer.activePass = -1;
+}
+
+void gpuTimerEndFrame()
+{
+	if (!gGpuTimer.enabled)
+		return;
+
+	int slot = gGpuTimer.frame % GpuTimerState::kLatency;
+	gGpuTimer.pending[slot] = gGpuTimer.issuedMask[slot] != 0;
+	gGpuTimer.frame++;
+}
+
+// Reads every outstanding frame, waiting if needed; for the end of a run
+void gpuTimerFlush()
+{
+	if (!gGpuTimer.enabled)
+		return;
+
+	for (int i = 1; i <= GpuTimerState::kLatency; ++i)
+		gpuTimerResolve((gGpuTimer.frame + i) % GpuTimerState::kLatency, true);
+	if (gGpuTimer.csv)
+		fflush(gGpuTimer.csv);
+}
+
+// Mean and max of a pass (or GPU_PASS_COUNT for the total) over the window
+void gpuPassRollingStats(int pass, float &meanMs, float &maxMs)
+{
+	meanMs = maxMs = 0.0f;
+	for (int i = 0; i < gGpuTimer.historyCount; ++i)
+	{
+		float v = gGpuTimer.history[pass][i];
+		meanMs += v;
+		maxMs = std::max(maxMs, v);
+	}
+	if (gGpuTimer.historyCount > 0)
+		meanMs /= gGpuTimer.historyCount;
+}
+
+// The part of the game state that moves on screen. The simulation snapshots
+// it around every step and display() draws a blend of the last two.
+struct RenderState
+{
+	float roadVelocity;   // track scroll
+	float translationX;
+	float jumpHeight;
+	float rotateX;
+	float rotateZ;
+
+	// Not blended; taken from the newer step
+	int score;
+	int gamefinish;
+	int variable;        // lane of the obstacle that ended the game
+	unsigned long long obstacleKey;
+	unsigned inputApplied;
+	float cursorX;
+};
+
+RenderState captureRenderState()
+{
+	RenderState s = {roadVelocity, translationX, jumpHeight, rotateX, rotateZ,
+					 score, gamefinish, variable, obstacleKey, inputApplied, cursorX};
+	return s;
+}
+
+glm::mat4 bunnyModelingMatrix(const RenderState &s)
+{
+	glm::mat4 matT = glm::translate(glm::mat4(1.0), glm::vec3(s.translationX+1, s.jumpHeight+4.5, -3));   //(x,y,z)
+	glm::mat4 matS = glm::scale(glm::mat4(1.0), glm::vec3(0.4, 0.4, 0.4));
+	glm::mat4 matR = glm::rotate<float>(glm::mat4(1.0), (s.rotateX / 180.) * M_PI, glm::vec3(0.0, 1.0, 0.0));
+	glm::mat4 matZ = glm::rotate<float>(glm::mat4(1.0), (s.rotateZ / 180.) * M_PI, glm::vec3(1.0, 0.0, 0.0));
+	return matT * matS * matR * matZ;
+}
+
+glm::mat4 bunnyModelingMatrix()
+{
+	return bunnyModelingMatrix(captureRenderState());
+}
+
+glm::mat4 roadTileMatrix(int lane, int tile, float scroll = roadVelocity)
+{
+	return glm::translate(glm::mat4(1.0), glm::vec3(-3 + lane * 2, -3, -trackLength() + fmod(2 * tile + scroll, trackLength())));
+}
+
+glm::mat4 obstacleMatrix(int lane, int tile, float scroll = roadVelocity)
+{
+	glm::mat4 matT = glm::translate(glm::mat4(1.0), glm::vec3(-3 + lane * 3, -1.5, -trackLength() + fmod(2 * tile + scroll, trackLength())));
+	glm::mat4 matS = glm::scale(glm::mat4(1.0), glm::vec3(0.4, 1.10, 0.5));
+	return matT * matS;
+}
+
+// ---------------------------------------------------------------------------
+// Obstacle table
+//
+// Every obstacle has a fixed place on the looping track: a lane and a
+// distance u = 2 * tile along the loop; only the scroll moves them on screen.
+// The table lists them once per scene layout, bucketed by lane and by
+// kBucketLength of track, and collision maps the bunny into the same track
+// space to visit only the buckets within reach. A tick costs the same with
+// three obstacles or thousands.
+// ---------------------------------------------------------------------------
+
+struct ObstacleTable
+{
+	static constexpr float kBucketLength = 2.0f;   // one tile
+
+	// Layout the table was built for
+	int lanes = -1;
+	int buckets = 0;
+	int stride = -1;
+
+	vector<int> bucketStart;   // lanes * buckets + 1 offsets into tiles
+	vector<int> tiles;         // obstacle tiles grouped by lane, then bucket
+};
+ObstacleTable gObstacles;
+
+void obstacleTableBuild()
+{
+	PROFILE_SCOPE("obstacleTableBuild");
+	ObstacleTable &t = gObstacles;
+	t.lanes = gLaneCount - 1;
+	t.buckets = std::max(1, (int)ceil(trackLength() / ObstacleTable::kBucketLength));
+	t.stride = gObstacleRowStride;
+	t.bucketStart.assign(t.lanes * t.buckets + 1, 0);
+	t.tiles.clear();
+
+	for (int lane = 0; lane < t.lanes; ++lane)
+	{
+		int *start = &t.bucketStart[lane * t.buckets];
+		int b = 0;
+		for (int tile = 0; tile < gTileCount; ++tile)
+		{
+			if (!isObstacleRow(tile))
+				continue;
+			int bucket = std::min(t.buckets - 1, (int)(2.0f * tile / ObstacleTable::kBucketLength));
+			while (b <= bucket)
+				start[b++] = (int)t.tiles.size();
+			t.tiles.push_back(tile);
+		}
+		while (b < t.buckets)
+			start[b++] = (int)t.tiles.size();
+	}
+	t.bucketStart[t.lanes * t.buckets] = (int)t.tiles.size();
+}
+
+// Calls fn(lane, tile) for every obstacle whose centre may be within reach of
+// (x, z) in both axes at the given scroll; lanes come in ascending order. The
+// caller does the exact test.
+template <class Fn>
+void obstaclesNear(float x, float z, float reach, float scroll, Fn fn)
+{
+	ObstacleTable &t = gObstacles;
+	if (t.lanes != gLaneCount - 1 || t.buckets * ObstacleTable::kBucketLength < trackLength() ||
+		t.stride != gObstacleRowStride)
+		obstacleTableBuild();
+
+	// Obstacle x is -3 + 3 * lane
+	int laneLo = std::max(0, (int)floor((x - reach + 3) / 3));
+	int laneHi = std::min(t.lanes - 1, (int)ceil((x + reach + 3) / 3));
+
+	// Obstacle z is -L + fmod(u + scroll, L); solve for the u under the bunny.
+	// One spare bucket on each side absorbs rounding.
+	float length = trackLength();
+	float u = fmod(z + length - fmod(scroll, length) + length, length);
+	int first = (int)floor((u - reach) / ObstacleTable::kBucketLength) - 1;
+	int last = (int)floor((u + reach) / ObstacleTable::kBucketLength) + 1;
+	last = std::min(last, first + t.buckets - 1);
+
+	for (int lane = laneLo; lane <= laneHi; ++lane)
+	{
+		for (int b = first; b <= last; ++b)
+		{
+			int bucket = lane * t.buckets + ((b % t.buckets) + t.buckets) % t.buckets;
+			for (int k = t.bucketStart[bucket]; k < t.bucketStart[bucket + 1]; ++k)
+				fn(lane, t.tiles[k]);
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+// Entity store
+//
+// Road tiles and obstacles are entities: an index into parallel component
+// arrays rather than a struct each. A system reads and writes only the
+// components it needs, walking those arrays front to back, so the cache holds
+// nothing else and the compiler can vectorize the loop; the scroll system,
+// for one, streams through trackU and posZ alone. Stores are sized when the
+// scene layout changes; spawning and recycling entities never allocates.
+// ---------------------------------------------------------------------------
+
+// Every entity is drawn with the cube mesh; the bunny keeps its own state
+// and draw path
+enum EntityFlags
+{
+	ENTITY_SCROLLS = 1,    // posZ follows the road scroll from trackU
+	ENTITY_BONUS = 2,
+	ENTITY_HIDDEN = 4,
+};
+
+struct EntityStore
+{
+	int count = 0;
+	vector<float> posX, posY, posZ;
+	vector<float> scaleX, scaleY, scaleZ;
+	vector<float> trackU;               // distance along the looping track
+	vector<unsigned char> material;     // gProgram index
+	vector<short> lane;
+	vector<int> tile;
+	vector<unsigned char> flags;        // EntityFlags
+};
+
+void entityStoreResize(EntityStore &s, int count)
+{
+	s.count = count;
+	s.posX.assign(count, 0);
+	s.posY.assign(count, 0);
+	s.posZ.assign(count, 0);
+	s.scaleX.assign(count, 1);
+	s.scaleY.assign(count, 1);
+	s.scaleZ.assign(count, 1);
+	s.trackU.assign(count, 0);
+	s.material.assign(count, 0);
+	s.lane.assign(count, 0);
+	s.tile.assign(count, 0);
+	s.flags.assign(count, 0);
+}
+
+// Places entity e where the model matrix m (translation and scale only)
+// puts a mesh, on a tile of the track
+void entitySpawn(EntityStore &s, int e, const glm::mat4 &m, int material, int lane, int tile, unsigned flags)
+{
+	s.posX[e] = m[3][0];
+	s.posY[e] = m[3][1];
+	s.posZ[e] = m[3][2];
+	s.scaleX[e] = m[0][0];
+	s.scaleY[e] = m[1][1];
+	s.scaleZ[e] = m[2][2];
+	s.trackU[e] = 2.0f * tile;
+	s.material[e] = (unsigned char)material;
+	s.lane[e] = (short)lane;
+	s.tile[e] = tile;
+	s.flags[e] = (unsigned char)flags;
+}
+
+glm::mat4 entityMatrix(const EntityStore &s, int e)
+{
+	glm::mat4 m(1.0f);
+	m[0][0] = s.scaleX[e];
+	m[1][1] = s.scaleY[e];
+	m[2][2] = s.scaleZ[e];
+	m[3] = glm::vec4(s.posX[e], s.posY[e], s.posZ[e], 1.0f);
+	return m;
+}
+
+// Scroll system: posZ = -L + (trackU + scroll) mod L for every scrolling
+// entity in [first, end)
+void entityScroll(EntityStore &s, int first, int end, float scroll)
+{
+	float length = trackLength();
+	const float *u = s.trackU.data();
+	const unsigned char *flags = s.flags.data();
+	float *z = s.posZ.data();
+	for (int e = first; e < end; ++e)
+	{
+		float w = u[e] + scroll;
+		float wrapped = w - length * floorf(w / length) - length;
+		z[e] = (flags[e] & ENTITY_SCROLLS) ? wrapped : z[e];
+	}
+}
+
+// ---------------------------------------------------------------------------
+// Batch transforms
+//
+// A road tile or obstacle differs from the identity only by a scale and a
+// translation, so its model matrix takes no arithmetic at all and its MVP is
+// the view-projection's first three columns scaled, plus one multiply-add
+// chain for the fourth: P V M = [sx c0, sy c1, sz c2, x c0 + y c1 + z c2 + c3].
+// transformBatch() writes both for a whole render list in one pass over the
+// component arrays instead of building and multiplying full glm matrices per
+// object. Columns are four-wide vectors: WASM SIMD on the web build
+// (-msimd128), SSE on x86, and with -mavx each matrix is stored as two
+// eight-float halves. Other targets run the same steps on a plain struct.
+// ---------------------------------------------------------------------------
+
+#if defined(__wasm_simd128__)
+typedef v128_t Float4;
+static inline Float4 float4(float a, float b, float c, float d) { return wasm_f32x4_make(a, b, c, d); }
+static inline Float4 float4Load(const float *p) { return wasm_v128_load(p); }
+static inline Float4 float4Splat(float v) { return wasm_f32x4_splat(v); }
+static inline Float4 float4Add(Float4 a, Float4 b) { return wasm_f32x4_add(a, b); }
+static inline Float4 float4Mul(Float4 a, Float4 b) { return wasm_f32x4_mul(a, b); }
+static inline void float4Store(float *p, Float4 v) { wasm_v128_store(p, v); }
+#elif defined(__SSE2__) || defined(_M_X64)
+typedef __m128 Float4;
+static inline Float4 float4(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+static inline Float4 float4Load(const float *p) { return _mm_loadu_ps(p); }
+static inline Float4 float4Splat(float v) { return _mm_set1_ps(v); }
+static inline Float4 float4Add(Float4 a, Float4 b) { return _mm_add_ps(a, b); }
+static inline Float4 float4Mul(Float4 a, Float4 b) { return _mm_mul_ps(a, b); }
+static inline void float4Store(float *p, Float4 v) { _mm_storeu_ps(p, v); }
+#else
+struct Float4 { float v[4]; };
+static inline Float4 float4(float a, float b, float c, float d) { Float4 r = {{a, b, c, d}}; return r; }
+static inline Float4 float4Load(const float *p) { return float4(p[0], p[1], p[2], p[3]); }
+static inline Float4 float4Splat(float v) { return float4(v, v, v, v); }
+static inline Float4 float4Add(Float4 a, Float4 b) { return float4(a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]); }
+static inline Float4 float4Mul(Float4 a, Float4 b) { return float4(a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]); }
+static inline void float4Store(float *p, Float4 v) { memcpy(p, v.v, sizeof(v.v)); }
+#endif
+
+// Column-major model matrices, 16 floats per entry of list, into model; with
+// viewProjection, the MVPs into mvp as well
+void transformBatch(const EntityStore &s, const int *list, int n, float *model,
+					const glm::mat4 *viewProjection = NULL, float *mvp = NULL)
+{
+	const float *x = s.posX.data(), *y = s.posY.data(), *z = s.posZ.data();
+	const float *sx = s.scaleX.data(), *sy = s.scaleY.data(), *sz = s.scaleZ.data();
+
+	for (int k = 0; k < n; ++k)
+	{
+		int e = list[k];
+		float *m = model + 16 * k;
+#if defined(__AVX__) && !defined(__wasm_simd128__)
+		_mm256_storeu_ps(m, _mm256_setr_ps(sx[e], 0, 0, 0, 0, sy[e], 0, 0));
+		_mm256_storeu_ps(m + 8, _mm256_setr_ps(0, 0, sz[e], 0, x[e], y[e], z[e], 1));
+#else
+		float4Store(m, float4(sx[e], 0, 0, 0));
+		float4Store(m + 4, float4(0, sy[e], 0, 0));
+		float4Store(m + 8, float4(0, 0, sz[e], 0));
+		float4Store(m + 12, float4(x[e], y[e], z[e], 1));
+#endif
+	}
+
+	if (!viewProjection || !mvp)
+		return;
+	const float *vp = glm::value_ptr(*viewProjection);
+	Float4 c0 = float4Load(vp), c1 = float4Load(vp + 4), c2 = float4Load(vp + 8), c3 = float4Load(vp + 12);
+	for (int k = 0; k < n; ++k)
+	{
+		int e = list[k];
+		float *m = mvp + 16 * k;
+		Float4 t = float4Add(float4Add(float4Mul(c0, float4Splat(x[e])), float4Mul(c1, float4Splat(y[e]))),
+							 float4Add(float4Mul(c2, float4Splat(z[e])), c3));
+#if defined(__AVX__) && !defined(__wasm_simd128__)
+		__m256 c01 = _mm256_insertf128_ps(_mm256_castps128_ps256(c0), c1, 1);
+		__m256 s01 = _mm256_insertf128_ps(_mm256_castps128_ps256(float4Splat(sx[e])), float4Splat(sy[e]), 1);
+		_mm256_storeu_ps(m, _mm256_mul_ps(c01, s01));
+		_mm256_storeu_ps(m + 8, _mm256_insertf128_ps(_mm256_castps128_ps256(float4Mul(c2, float4Splat(sz[e]))), t, 1));
+#else
+		float4Store(m, float4Mul(c0, float4Splat(sx[e])));
+		float4Store(m + 4, float4Mul(c1, float4Splat(sy[e])));
+		float4Store(m + 8, float4Mul(c2, float4Splat(sz[e])));
+		float4Store(m + 12, t);
+#endif
+	}
+}
+
+// ---------------------------------------------------------------------------
+// Obstacle stream
+//
+// Which lane of an obstacle row holds the bonus comes from a counter-based
+// random stream: the row on tile j in lap k of the track draws element
+// k * tiles + j of the current game's stream, a pure hash of the seed, the
+// game number and that counter. The layout so depends only on --seed, the
+// number of resets and how far the road has scrolled, never on frame rate,
+// tick length or other rand() callers, and display() can work out any row's
+// lane from the scroll alone. The simulation keeps the rows on the track and
+// the whole next lap in a ring buffer in the order they appear at the far end,
+// and gives each row on the track a block of obstacle entities from a fixed
+// pool that the row hands back when it scrolls off. Both are sized when the
+// scene layout changes; spawning never allocates.
+// ---------------------------------------------------------------------------
+
+// SplitMix64's finaliser over (key, counter): any element of the stream is
+// one hash away, without stepping through the ones before it
+unsigned long long streamRandom(unsigned long long key, unsigned long long counter)
+{
+	unsigned long long z = key + (counter + 1) * 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+// Lap of the track the obstacle on this tile is in at the given scroll
+long long obstacleLap(int tile, float scroll)
+{
+	return (long long)floor((2 * tile + scroll) / trackLength());
+}
+
+// Bonus lane of the row on this tile in this lap
+int obstacleRowLane(unsigned long long key, long long lap, int tile)
+{
+	unsigned long long counter = (unsigned long long)lap * gTileCount + tile;
+	return (int)(streamRandom(key, counter) % (gLaneCount - 1));
+}
+
+// Bonus lane of the row on this tile at the given scroll
+int obstacleBonusLane(unsigned long long key, int tile, float scroll)
+{
+	return obstacleRowLane(key, obstacleLap(tile, scroll), tile);
+}
+
+struct ObstacleRow
+{
+	int tile;
+	int bonusLane;
+	int block;      // entity block while on the track, else -1
+};
+
+struct ObstacleStream
+{
+	unsigned seed = 1;
+	unsigned game = 0;
+
+	// Layout the stream was built for
+	int lanes = -1;
+	int tiles = -1;
+	int stride = -1;
+
+	// Rows in order of appearance: row a is on tile rowTiles[a % R] in lap
+	// a / R, R = rowTiles.size(). Rows [head, spawned) are on the track,
+	// [spawned, generated) are queued.
+	vector<int> rowTiles;       // obstacle tiles, far end of the track first
+	vector<ObstacleRow> ring;   // power-of-two size, row a at a & (size - 1)
+	long long head = 0, spawned = 0, generated = 0;
+	vector<int> slotOfTile;     // ring slot of the row on each tile, or -1
+
+	EntityStore pool;           // one block of `lanes` per row on the track
+	vector<int> freeBlocks;
+	unsigned long long rowsSpawned = 0;
+};
+ObstacleStream gObstacleStream;
+
+static long long floorDiv(long long a, long long b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static ObstacleRow &obstacleRow(long long a)
+{
+	ObstacleStream &st = gObstacleStream;
+	return st.ring[a & ((long long)st.ring.size() - 1)];
+}
+
+// Queues rows up to a whole lap past the last one on the track
+static void obstacleStreamGenerate()
+{
+	ObstacleStream &st = gObstacleStream;
+	long long rows = (long long)st.rowTiles.size();
+	for (; st.generated < st.spawned + rows; ++st.generated)
+	{
+		ObstacleRow &row = obstacleRow(st.generated);
+		row.tile = st.rowTiles[st.generated % rows];
+		row.bonusLane = obstacleRowLane(obstacleKey, floorDiv(st.generated, rows), row.tile);
+		row.block = -1;
+	}
+}
+
+static void obstacleRowSpawn(long long a)
+{
+	ObstacleStream &st = gObstacleStream;
+	ObstacleRow &row = obstacleRow(a);
+	row.block = st.freeBlocks.back();
+	st.freeBlocks.pop_back();
+	for (int lane = 0; lane < st.lanes; ++lane)
+		entitySpawn(st.pool, row.block * st.lanes + lane, obstacleMatrix(lane, row.tile, 0), lane == row.bonusLane ? 4 : 3,
+					lane, row.tile, ENTITY_SCROLLS | (lane == row.bonusLane ? ENTITY_BONUS : 0));
+	st.slotOfTile[row.tile] = (int)(&row - &st.ring[0]);
+	st.rowsSpawned++;
+}
+
+static void obstacleRowRetire(long long a)
+{
+	ObstacleStream &st = gObstacleStream;
+	ObstacleRow &row = obstacleRow(a);
+	for (int lane = 0; lane < st.lanes; ++lane)
+		st.pool.flags[row.block * st.lanes + lane] = 0;
+	st.freeBlocks.push_back(row.block);
+	row.block = -1;
+}
+
+// Rebuilds the stream for the current layout and game, with the rows that
+// are on the track at this scroll
+void obstacleStreamReset(float scroll)
+{
+	PROFILE_SCOPE("obstacleStreamReset");
+	ObstacleStream &st = gObstacleStream;
+	if (st.lanes != gLaneCount - 1 || st.tiles != gTileCount || st.stride != gObstacleRowStride)
+	{
+		st.lanes = gLaneCount - 1;
+		st.tiles = gTileCount;
+		st.stride = gObstacleRowStride;
+		st.rowTiles.clear();
+		for (int tile = gTileCount - 1; tile >= 0; --tile)
+			if (isObstacleRow(tile))
+				st.rowTiles.push_back(tile);
+
+		size_t capacity = 1;
+		while (capacity < 2 * st.rowTiles.size())
+			capacity *= 2;
+		st.ring.assign(capacity, ObstacleRow());
+		entityStoreResize(st.pool, (int)st.rowTiles.size() * st.lanes);
+		st.freeBlocks.reserve(st.rowTiles.size());
+		st.slotOfTile.resize(gTileCount);
+	}
+	std::fill(st.slotOfTile.begin(), st.slotOfTile.end(), -1);
+	std::fill(st.pool.flags.begin(), st.pool.flags.end(), 0);
+	st.freeBlocks.clear();
+	for (int b = (int)st.rowTiles.size() - 1; b >= 0; --b)
+		st.freeBlocks.push_back(b);
+
+	// Each tile shows the newest row of its own; the lap of rows ending with
+	// the newest of those is on the track
+	long long rows = (long long)st.rowTiles.size();
+	long long newest = -1;
+	for (long long r = 0; r < rows; ++r)
+		newest = std::max(newest, obstacleLap(st.rowTiles[r], scroll) * rows + r);
+	st.head = st.spawned = st.generated = newest + 1 - rows;
+	obstacleStreamGenerate();
+	for (; st.spawned <= newest; ++st.spawned)
+		obstacleRowSpawn(st.spawned);
+	obstacleStreamGenerate();
+}
+
+// Picks the stream for a new seed; the rows follow on the next tick
+void obstacleStreamSeed(unsigned seed)
+{
+	gObstacleStream.seed = seed;
+	gObstacleStream.game = 0;
+	obstacleKey = streamRandom(seed, 0);
+	gObstacleStream.lanes = -1;
+}
+
+// Starts the next game's stream
+void obstacleStreamNewGame(float scroll)
+{
+	obstacleKey = streamRandom(gObstacleStream.seed, ++gObstacleStream.game);
+	obstacleStreamReset(scroll);
+}
+
+// Spawns the rows that have reached the far end of the track by this scroll,
+// each retiring the row it replaces
+void obstacleStreamAdvance(float scroll)
+{
+	ObstacleStream &st = gObstacleStream;
+	if (st.lanes != gLaneCount - 1 || st.tiles != gTileCount || st.stride != gObstacleRowStride)
+	{
+		obstacleStreamReset(scroll);
+		return;
+	}
+	long long rows = (long long)st.rowTiles.size();
+	if (rows == 0)
+		return;
+
+	// A tick that skips more than a lap starts over where it lands
+	if (obstacleLap(st.rowTiles[st.spawned % rows], scroll) > floorDiv(st.spawned, rows) + 1)
+	{
+		obstacleStreamReset(scroll);
+		return;
+	}
+	while (obstacleLap(st.rowTiles[st.spawned % rows], scroll) >= floorDiv(st.spawned, rows))
+	{
+		obstacleRowRetire(st.head++);
+		obstacleRowSpawn(st.spawned++);
+		obstacleStreamGenerate();
+	}
+}
+
+// Pool entity of the obstacle on (lane, tile), or -1 if no row is there
+int obstacleEntity(int lane, int tile)
+{
+	ObstacleStream &st = gObstacleStream;
+	if (tile < 0 || tile >= (int)st.slotOfTile.size() || st.slotOfTile[tile] < 0 || lane < 0 || lane >= st.lanes)
+		return -1;
+	return st.ring[st.slotOfTile[tile]].block * st.lanes + lane;
+}
+
+// ---------------------------------------------------------------------------
+// Scene entities
+//
+// What display() draws of the track, as entities: a road tile per lane and
+// tile, then an obstacle per lane of each obstacle row, rebuilt when the
+// layout changes. Every frame the scroll system places them for the blended
+// view, the obstacle system sets their bonus and hidden flags from the
+// obstacle stream, and the render list gathers the visible ones per pass
+// grouped by material, so each pass binds a program and sets its camera
+// uniforms once per material rather than once per draw. A batch transform
+// then writes the list's model matrices. The bunny keeps its own pass: its
+// rotation and late-latched cursor are not components.
+// ---------------------------------------------------------------------------
+
+enum ScenePass { SCENE_PASS_ROAD, SCENE_PASS_OBSTACLES, SCENE_PASS_COUNT };
+
+struct SceneEntities
+{
+	static const int kMaterials = 5;   // gProgram entries
+
+	EntityStore store;
+
+	// Layout the store was built for
+	int lanes = -1;
+	int tiles = -1;
+	int stride = -1;
+
+	int firstObstacle = 0;   // road tiles come first
+
+	vector<int> renderList;                  // by pass, then material
+	vector<float> models;                    // model matrix per render list entry
+	int passStart[SCENE_PASS_COUNT + 1] = {};
+};
+SceneEntities gScene;
+
+// Spawn system: one entity per road tile and obstacle of the layout
+static void sceneSpawn()
+{
+	SceneEntities &sc = gScene;
+	if (sc.lanes == gLaneCount && sc.tiles == gTileCount && sc.stride == gObstacleRowStride)
+		return;
+	PROFILE_SCOPE("sceneSpawn");
+	sc.lanes = gLaneCount;
+	sc.tiles = gTileCount;
+	sc.stride = gObstacleRowStride;
+
+	int rows = 0;
+	for (int tile = 0; tile < gTileCount; ++tile)
+		rows += isObstacleRow(tile);
+	sc.firstObstacle = gLaneCount * gTileCount;
+	entityStoreResize(sc.store, sc.firstObstacle + rows * (gLaneCount - 1));
+	sc.renderList.resize(sc.store.count);
+	sc.models.resize(16 * sc.store.count);
+
+	// Road tiles alternate the two road programs like a checkerboard
+	int e = 0;
+	for (int lane = 0; lane < gLaneCount; ++lane)
+		for (int tile = 0; tile < gTileCount; ++tile)
+			entitySpawn(sc.store, e++, roadTileMatrix(lane, tile, 0), (lane * (gTileCount + 1) + tile) % 2 ? 2 : 1,
+						lane, tile, ENTITY_SCROLLS);
+	for (int lane = 0; lane < gLaneCount - 1; ++lane)
+		for (int tile = 0; tile < gTileCount; ++tile)
+			if (isObstacleRow(tile))
+				entitySpawn(sc.store, e++, obstacleMatrix(lane, tile, 0), 3, lane, tile, ENTITY_SCROLLS);
+}
+
+// Obstacle system: bonus lanes come from the stream for the row showing on
+// each tile; a game over hides the other obstacles in the lane that was hit
+static void sceneObstacles(const RenderState &view)
+{
+	EntityStore &st = gScene.store;
+	for (int e = gScene.firstObstacle; e < st.count; ++e)
+	{
+		bool bonus = obstacleBonusLane(view.obstacleKey, st.tile[e], view.roadVelocity) == st.lane[e];
+		bool hidden = !bonus && view.gamefinish != 0 && view.variable == st.lane[e];
+		st.material[e] = bonus ? 4 : 3;
+		st.flags[e] = (st.flags[e] & ~(ENTITY_BONUS | ENTITY_HIDDEN)) | (bonus ? ENTITY_BONUS : 0) | (hidden ? ENTITY_HIDDEN : 0);
+	}
+}
+
+// Render-list system: a counting sort of the visible entities of each pass
+// by material
+static void sceneRenderList()
+{
+	SceneEntities &sc = gScene;
+	const EntityStore &st = sc.store;
+	int ranges[SCENE_PASS_COUNT + 1] = {0, sc.firstObstacle, st.count};
+	int n = 0;
+	for (int pass = 0; pass < SCENE_PASS_COUNT; ++pass)
+	{
+		sc.passStart[pass] = n;
+		int start[SceneEntities::kMaterials + 1] = {};
+		for (int e = ranges[pass]; e < ranges[pass + 1]; ++e)
+			start[st.material[e] + 1] += !(st.flags[e] & ENTITY_HIDDEN);
+		start[0] = n;
+		for (int m = 1; m <= SceneEntities::kMaterials; ++m)
+			start[m] += start[m - 1];
+		for (int e = ranges[pass]; e < ranges[pass + 1]; ++e)
+			if (!(st.flags[e] & ENTITY_HIDDEN))
+				sc.renderList[start[st.material[e]]++] = e;
+		n = start[SceneEntities::kMaterials - 1];
+	}
+	sc.passStart[SCENE_PASS_COUNT] = n;
+}
+
+// Runs the scene systems for the view about to be drawn
+void sceneUpdate(const RenderState &view)
+{
+	PROFILE_SCOPE("sceneUpdate");
+	sceneSpawn();
+	entityScroll(gScene.store, 0, gScene.store.count, view.roadVelocity);
+	sceneObstacles(view);
+	sceneRenderList();
+	transformBatch(gScene.store, gScene.renderList.data(), gScene.passStart[SCENE_PASS_COUNT], gScene.models.data());
+}
+
+// ---------------------------------------------------------------------------
+// Triangle BVH
+//
+// --precise-collision narrows the box hits below down to bunny.obj's actual
+// triangles. They are sorted into a bounding volume hierarchy once at load.
+// The tree is four-wide and flattened into one array: each node stores its
+// children's bounds as separate min/max x/y/z arrays of four, so all four
+// children are tested with the same straight-line code, which the compiler
+// vectorizes, and a leaf is a run of triangle corners copied out in tree
+// order. A query culls nodes against the query box mapped into the bunny's
+// object space and runs a separating axis box-triangle test at the leaves.
+// It uses a fixed stack and never allocates.
+// ---------------------------------------------------------------------------
+
+struct alignas(16) BvhNode
+{
+	float minX[4], minY[4], minZ[4];
+	float maxX[4], maxY[4], maxZ[4];
+	int child[4];   // inner node index, or for a leaf the first triangle
+	int count[4];   // triangles in a leaf; 0 for an inner node or empty slot
+};
+
+struct TriangleBvh
+{
+	static constexpr int kLeafSize = 4;
+	static constexpr int kMaxDepth = 48;
+
+	vector<BvhNode> nodes;       // nodes[0] is the root
+	vector<glm::vec3> corners;   // three per triangle, in leaf order
+};
+TriangleBvh gBunnyBvh;
+
+static void bvhSetChild(BvhNode &node, int k, const vector<Vertex> &vertices, const vector<Face> &faces,
+						const vector<int> &order, int begin, int end)
+{
+	node.minX[k] = node.minY[k] = node.minZ[k] = 1e30f;
+	node.maxX[k] = node.maxY[k] = node.maxZ[k] = -1e30f;
+	for (int i = begin; i < end; ++i)
+		for (int c = 0; c < 3; ++c)
+		{
+			const Vertex &v = vertices[faces[order[i]].vIndex[c]];
+			node.minX[k] = std::min(node.minX[k], v.x);
+			node.minY[k] = std::min(node.minY[k], v.y);
+			node.minZ[k] = std::min(node.minZ[k], v.z);
+			node.maxX[k] = std::max(node.maxX[k], v.x);
+			node.maxY[k] = std::max(node.maxY[k], v.y);
+			node.maxZ[k] = std::max(node.maxZ[k], v.z);
+		}
+}
+
+// Splits order[begin, end) at the centroid median of its longest axis
+static int bvhSplit(const vector<glm::vec3> &centroids, vector<int> &order, int begin, int end)
+{
+	glm::vec3 lo(1e30f), hi(-1e30f);
+	for (int i = begin; i < end; ++i)
+	{
+		lo = glm::min(lo, centroids[order[i]]);
+		hi = glm::max(hi, centroids[order[i]]);
+	}
+	glm::vec3 extent = hi - lo;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	int mid = (begin + end) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+					 [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+	return mid;
+}
+
+static int bvhBuildNode(TriangleBvh &bvh, const vector<Vertex> &vertices, const vector<Face> &faces,
+						const vector<glm::vec3> &centroids, vector<int> &order, int begin, int end)
+{
+	// Two levels of binary splits give up to four children
+	int ranges[5] = {begin, end, end, end, end};
+	int n = 1;
+	for (int level = 0; level < 2; ++level)
+	{
+		int next[5];
+		int m = 0;
+		next[0] = ranges[0];
+		for (int r = 0; r < n; ++r)
+		{
+			if (ranges[r + 1] - ranges[r] > TriangleBvh::kLeafSize)
+				next[++m] = bvhSplit(centroids, order, ranges[r], ranges[r + 1]);
+			next[++m] = ranges[r + 1];
+		}
+		n = m;
+		std::copy(next, next + n + 1, ranges);
+	}
+
+	int index = (int)bvh.nodes.size();
+	bvh.nodes.push_back(BvhNode());
+	for (int k = 0; k < 4; ++k)
+	{
+		BvhNode node = bvh.nodes[index];
+		int count = k < n ? ranges[k + 1] - ranges[k] : 0;
+		bvhSetChild(node, k, vertices, faces, order, k < n ? ranges[k] : 0, k < n ? ranges[k + 1] : 0);
+		node.child[k] = k < n ? ranges[k] : 0;
+		node.count[k] = count <= TriangleBvh::kLeafSize ? count : 0;
+		bvh.nodes[index] = node;
+		if (count > TriangleBvh::kLeafSize)
+		{
+			int child = bvhBuildNode(bvh, vertices, faces, centroids, order, ranges[k], ranges[k + 1]);
+			bvh.nodes[index].child[k] = child;
+		}
+	}
+	return index;
+}
+
+void bvhBuild(TriangleBvh &bvh, const vector<Vertex> &vertices, const vector<Face> &faces)
+{
+	PROFILE_SCOPE("bvhBuild");
+	bvh.nodes.clear();
+	bvh.corners.clear();
+	if (faces.empty())
+		return;
+
+	vector<glm::vec3> centroids(faces.size());
+	vector<int> order(faces.size());
+	for (size_t i = 0; i < faces.size(); ++i)
+	{
+		glm::vec3 c(0);
+		for (int k = 0; k < 3; ++k)
+		{
+			const Vertex &v = vertices[faces[i].vIndex[k]];
+			c += glm::vec3(v.x, v.y, v.z);
+		}
+		centroids[i] = c / 3.0f;
+		order[i] = (int)i;
+	}
+
+	bvh.nodes.reserve(2 * faces.size() / TriangleBvh::kLeafSize + 1);
+	bvhBuildNode(bvh, vertices, faces, centroids, order, 0, (int)faces.size());
+
+	bvh.corners.resize(3 * faces.size());
+	for (size_t i = 0; i < faces.size(); ++i)
+		for (int k = 0; k < 3; ++k)
+		{
+			const Vertex &v = vertices[faces[order[i]].vIndex[k]];
+			bvh.corners[3 * i + k] = glm::vec3(v.x, v.y, v.z);
+		}
+
+	if (gDebugLogs)
+		cout << "BVH: " << faces.size() << " triangles, " << bvh.nodes.size() << " nodes" << endl;
+}
+
+// Separating axis test of triangle abc against the box |p| <= half
+bool triangleOverlapsBox(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 half)
+{
+	// The box's face normals
+	for (int k = 0; k < 3; ++k)
+		if (std::min(a[k], std::min(b[k], c[k])) > half[k] || std::max(a[k], std::max(b[k], c[k])) < -half[k])
+			return false;
+
+	// The triangle's normal
+	glm::vec3 edges[3] = {b - a, c - b, a - c};
+	glm::vec3 n = glm::cross(edges[0], edges[1]);
+	if (fabs(glm::dot(n, a)) > half.x * fabs(n.x) + half.y * fabs(n.y) + half.z * fabs(n.z))
+		return false;
+
+	// Each edge crossed with each box axis
+	for (int e = 0; e < 3; ++e)
+		for (int k = 0; k < 3; ++k)
+		{
+			glm::vec3 unit(0);
+			unit[k] = 1;
+			glm::vec3 axis = glm::cross(unit, edges[e]);
+			float pa = glm::dot(axis, a), pb = glm::dot(axis, b), pc = glm::dot(axis, c);
+			float r = half.x * fabs(axis.x) + half.y * fabs(axis.y) + half.z * fabs(axis.z);
+			if (std::min(pa, std::min(pb, pc)) > r || std::max(pa, std::max(pb, pc)) < -r)
+				return false;
+		}
+	return true;
+}
+
+void bunnyBvhBuild()
+{
+	bvhBuild(gBunnyBvh, gVertices, gFaces);
+}
+
+// Whether any triangle, placed in the world by model, overlaps the world box
+// centre +- half
+bool bvhOverlapsBox(const TriangleBvh &bvh, const glm::mat4 &model, glm::vec3 centre, glm::vec3 half)
+{
+	if (bvh.nodes.empty())
+		return false;
+
+	// The box's bounds in object space, for culling nodes
+	glm::mat4 inv = glm::inverse(model);
+	glm::vec4 oc = inv * glm::vec4(centre, 1);
+	float ohx = fabs(inv[0][0]) * half.x + fabs(inv[1][0]) * half.y + fabs(inv[2][0]) * half.z;
+	float ohy = fabs(inv[0][1]) * half.x + fabs(inv[1][1]) * half.y + fabs(inv[2][1]) * half.z;
+	float ohz = fabs(inv[0][2]) * half.x + fabs(inv[1][2]) * half.y + fabs(inv[2][2]) * half.z;
+	float loX = oc.x - ohx, loY = oc.y - ohy, loZ = oc.z - ohz;
+	float hiX = oc.x + ohx, hiY = oc.y + ohy, hiZ = oc.z + ohz;
+
+	int stack[TriangleBvh::kMaxDepth * 3 + 1];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const BvhNode &node = bvh.nodes[stack[--top]];
+		bool overlap[4];
+		for (int k = 0; k < 4; ++k)
+			overlap[k] = (node.minX[k] <= hiX) & (node.maxX[k] >= loX) & (node.minY[k] <= hiY) &
+						 (node.maxY[k] >= loY) & (node.minZ[k] <= hiZ) & (node.maxZ[k] >= loZ);
+
+		for (int k = 0; k < 4; ++k)
+		{
+			if (!overlap[k])
+				continue;
+			if (node.count[k] == 0)
+			{
+				stack[top++] = node.child[k];
+				continue;
+			}
+			for (int t = node.child[k]; t < node.child[k] + node.count[k]; ++t)
+			{
+				const glm::vec3 *p = &bvh.corners[3 * t];
+				glm::vec3 a = glm::vec3(model * glm::vec4(p[0], 1)) - centre;
+				glm::vec3 b = glm::vec3(model * glm::vec4(p[1], 1)) - centre;
+				glm::vec3 c = glm::vec3(model * glm::vec4(p[2], 1)) - centre;
+				if (triangleOverlapsBox(a, b, c, half))
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
+// ---------------------------------------------------------------------------
+// Swept collision
+//
+// The road scrolls a little further every tick as the score grows, and once
+// a tick moves it further than an obstacle is deep, testing only where the
+// bunny ends up lets obstacles pass straight through it. Instead each tick
+// tests the whole path the bunny's box took relative to the obstacle's box
+// since the previous tick. Both boxes are the x/z bounds of the real meshes
+// under their current model matrices; height is ignored because the bunny's
+// bob never clears an obstacle. The path is measured along the looping track,
+// so a tick that scrolls further than a whole lap still hits, and since it
+// spans exactly one simulation step the outcome depends only on the tick
+// sequence, never on the frame rate.
+// ---------------------------------------------------------------------------
+
+struct FlatBox
+{
+	glm::vec2 centre;   // world x, z
+	glm::vec2 half;
+};
+
+// Axis-aligned bounds of the box b after transforming it by m
+void transformedBounds(const glm::mat4 &m, const MeshBounds &b, glm::vec3 &centre, glm::vec3 &half)
+{
+	glm::vec3 c((b.minX + b.maxX) / 2, (b.minY + b.maxY) / 2, (b.minZ + b.maxZ) / 2);
+	glm::vec3 h((b.maxX - b.minX) / 2, (b.maxY - b.minY) / 2, (b.maxZ - b.minZ) / 2);
+	centre = glm::vec3(m * glm::vec4(c, 1));
+	for (int k = 0; k < 3; ++k)
+		half[k] = fabs(m[0][k]) * h.x + fabs(m[1][k]) * h.y + fabs(m[2][k]) * h.z;
+}
+
+// x/z extent of the box b after transforming it by m
+FlatBox flatBox(const glm::mat4 &m, const MeshBounds &b)
+{
+	glm::vec3 centre, half;
+	transformedBounds(m, b, centre, half);
+	FlatBox box;
+	box.centre = glm::vec2(centre.x, centre.z);
+	box.half = glm::vec2(half.x, half.z);
+	return box;
+}
+
+// Whether the segment from p0 to p1 touches the box |p| <= half
+bool segmentHitsBox(glm::vec2 p0, glm::vec2 p1, glm::vec2 half)
+{
+	float t0 = 0, t1 = 1;
+	for (int a = 0; a < 2; ++a)
+	{
+		float d = p1[a] - p0[a];
+		if (d == 0)
+		{
+			if (fabs(p0[a]) > half[a])
+				return false;
+			continue;
+		}
+		float ta = (-half[a] - p0[a]) / d;
+		float tb = (half[a] - p0[a]) / d;
+		if (ta > tb)
+			std::swap(ta, tb);
+		t0 = std::max(t0, ta);
+		t1 = std::min(t1, tb);
+		if (t0 > t1)
+			return false;
+	}
+	return true;
+}
+
+struct SweptCollisionState
+{
+	static constexpr float kBonusMargin = 0.5f;   // bonus obstacles reach this far past their box
+
+	// Where the previous tick tested; invalid after a reset, which makes the
+	// next tick a plain overlap test
+	bool valid = false;
+	float scroll = 0;
+	float bunnyX = 0;
+};
+SweptCollisionState gSweep;
+
+// Collide system: one tick's bunny path against the obstacle entities, after
+// the scroll system has placed them. fn(entity, bonusOnly) is called for
+// every obstacle the path touches; bonusOnly is set when it came
+// within kBonusMargin of the box without touching it, or with
+// --precise-collision, without touching a triangle.
+template <class Fn>
+void sweptObstacleHits(const glm::mat4 &bunny, float scroll, Fn fn)
+{
+	FlatBox body = flatBox(bunny, gBunnyBounds);
+	glm::mat4 cubeModel = obstacleMatrix(0, 0, 0);
+	cubeModel[3].x = cubeModel[3].z = 0;
+	glm::vec3 cubeCentre, cubeHalf;   // x/z centre relative to the obstacle's translation
+	transformedBounds(cubeModel, gObstacleBounds, cubeCentre, cubeHalf);
+	FlatBox cube = flatBox(cubeModel, gObstacleBounds);
+
+	float scroll0 = gSweep.valid ? gSweep.scroll : scroll;
+	float x0 = gSweep.valid ? gSweep.bunnyX : body.centre.x;
+	float travel = scroll - scroll0;
+	gSweep.valid = true;
+	gSweep.scroll = scroll;
+	gSweep.bunnyX = body.centre.x;
+
+	float length = trackLength();
+	glm::vec2 half = body.half + cube.half;
+	glm::vec2 bonusHalf = half + SweptCollisionState::kBonusMargin;
+	float reach = std::max(bonusHalf.x + fabs(body.centre.x - x0) / 2, bonusHalf.y + travel / 2);
+
+	// Obstacle translations sought around the middle of the path
+	float qx = (x0 + body.centre.x) / 2 - cube.centre.x;
+	float qz = body.centre.y - cube.centre.y;
+	const EntityStore &pool = gObstacleStream.pool;
+	obstaclesNear(qx, qz, reach, scroll0 + travel / 2, [&](int lane, int tile) {
+		int e = obstacleEntity(lane, tile);
+		if (e < 0)
+			return;
+		float ox = pool.posX[e] + cube.centre.x;
+		float oz = pool.posZ[e] - travel + cube.centre.y;   // at the previous tick
+
+		// Bunny-minus-obstacle offset at the previous tick, taken on the lap
+		// where the obstacle is just reaching the bunny; the obstacle then
+		// advances by travel
+		float dz = fmod(body.centre.y - oz + bonusHalf.y, length);
+		if (dz < 0)
+			dz += length;
+		dz -= bonusHalf.y;
+		glm::vec2 p0(x0 - ox, dz);
+		glm::vec2 p1(body.centre.x - ox, dz - travel);
+
+		if (segmentHitsBox(p0, p1, half))
+		{
+			// Narrow phase: the box enclosing the obstacle's whole path
+			// relative to the bunny, against the bunny's triangles
+			bool touched = true;
+			if (gPreciseCollision)
+			{
+				glm::vec3 centre(body.centre.x - (p0.x + p1.x) / 2, cubeCentre.y, body.centre.y - (p0.y + p1.y) / 2);
+				glm::vec3 extent(cube.half.x + fabs(p1.x - p0.x) / 2, cubeHalf.y, cube.half.y + fabs(p1.y - p0.y) / 2);
+				touched = bvhOverlapsBox(gBunnyBvh, bunny, centre, extent);
+			}
+			fn(e, !touched);
+		}
+		else if (segmentHitsBox(p0, p1, bonusHalf))
+			fn(e, true);
+	});
+}
+
+// ---------------------------------------------------------------------------
+// Hardware counters
+//
+// --perf-counters opens one Linux perf_event_open group (cycles,
+// instructions, cache and branch misses, plus task clock and page faults)
+// for this thread. PERF_REGION(r) charges the counts from that line to the
+// end of the block to region r; an inner region pauses its parent, so every
+// count belongs to exactly one region. Counters the kernel or VM refuses are
+// reported as null. Without perf_event_open (other platforms, the web build,
+// or a locked-down kernel) regions cost one branch and the report says why.
+// ---------------------------------------------------------------------------
+
+enum PerfRegion
+{
+	PERF_SUBMISSION,   // display() minus the simulation update
+	PERF_SIMULATION,
+	PERF_SWAP,
+	PERF_EVENTS,
+	PERF_REGION_COUNT
+};
+
+const char *kPerfRegionNames[PERF_REGION_COUNT] = {"submission", "simulation", "swap", "events"};
+
+enum PerfCounter
+{
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_TASK_CLOCK,    // ns on the CPU
+	PERF_PAGE_FAULTS,
+	PERF_COUNTER_COUNT
+};
+
+const char *kPerfCounterNames[PERF_COUNTER_COUNT] = {"cycles", "instructions", "cache_misses", "branch_misses",
+													 "task_clock_ns", "page_faults"};
+
+struct PerfCounterState
+{
+	static const int kMaxDepth = 4;
+
+	bool requested = false;   // --perf-counters
+	bool enabled = false;
+	string error;             // why counters are off, for the report
+	int fd[PERF_COUNTER_COUNT];
+	int groupIndex[PERF_COUNTER_COUNT];   // position in the group read, -1 if not open
+	int groupSize = 0;
+
+	unsigned long long last[PERF_COUNTER_COUNT] = {};   // at the previous region boundary
+	int stack[kMaxDepth];
+	int depth = 0;
+
+	unsigned long long frame[PERF_REGION_COUNT][PERF_COUNTER_COUNT] = {};
+	unsigned long long total[PERF_REGION_COUNT][PERF_COUNTER_COUNT] = {};
+	long long frames = 0;
+};
+PerfCounterState gPerf;
+
+// The counters follow the thread that opened them; regions entered on any
+// other thread (the simulation thread) are not charged.
+static thread_local bool tPerfOwner = false;
+
+#ifdef __linux__
+static int perfOpen(unsigned int type, unsigned long long config, int groupFd)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;   // allowed at perf_event_paranoid 2
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.disabled = groupFd < 0;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+// Reads the whole group at once, scaled up if the kernel multiplexed it
+static void perfRead(unsigned long long values[PERF_COUNTER_COUNT])
+{
+	unsigned long long buf[3 + PERF_COUNTER_COUNT];
+	int leader = -1;
+	for (int c = 0; c < PERF_COUNTER_COUNT && leader < 0; ++c)
+		if (gPerf.groupIndex[c] == 0)
+			leader = gPerf.fd[c];
+	if (read(leader, buf, sizeof(buf)) < (ssize_t)((3 + gPerf.groupSize) * sizeof(unsigned long long)))
+		return;
+
+	double scale = buf[2] > 0 ? (double)buf[1] / buf[2] : 0.0;
+	for (int c = 0; c < PERF_COUNTER_COUNT; ++c)
+		if (gPerf.groupIndex[c] >= 0)
+			values[c] = (unsigned long long)(buf[3 + gPerf.groupIndex[c]] * scale);
+}
+#endif
+
+void perfCountersInit()
+{
+	#ifdef __linux__
+	static const struct { unsigned int type; unsigned long long config; } kEvents[PERF_COUNTER_COUNT] = {
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+		{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+		{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+	};
+
+	// The first counter that opens leads the group
+	int leader = -1;
+	string refused;
+	for (int c = 0; c < PERF_COUNTER_COUNT; ++c)
+	{
+		gPerf.fd[c] = perfOpen(kEvents[c].type, kEvents[c].config, leader);
+		gPerf.groupIndex[c] = -1;
+		if (gPerf.fd[c] < 0)
+		{
+			refused += string(refused.empty() ? "" : ", ") + kPerfCounterNames[c] + " (" + strerror(errno) + ")";
+			continue;
+		}
+		if (leader < 0)
+			leader = gPerf.fd[c];
+		gPerf.groupIndex[c] = gPerf.groupSize++;
+	}
+
+	if (leader < 0)
+	{
+		gPerf.error = "perf_event_open failed: " + refused;
+		if (gDebugLogs) fprintf(stderr, "Hardware counters disabled; %s\n", gPerf.error.c_str());
+		return;
+	}
+	if (!refused.empty())
+	{
+		gPerf.error = "unavailable: " + refused;
+		if (gDebugLogs) fprintf(stderr, "Some counters are unavailable: %s\n", refused.c_str());
+	}
+
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	perfRead(gPerf.last);
+	gPerf.enabled = true;
+	tPerfOwner = true;
+	#else
+	gPerf.error = "perf_event_open is Linux only";
+	#endif
+}
+
+// Charges everything since the last boundary to the innermost open region
+static void perfCharge()
+{
+	#ifdef __linux__
+	unsigned long long now[PERF_COUNTER_COUNT];
+	memcpy(now, gPerf.last, sizeof(now));
+	perfRead(now);
+	if (gPerf.depth > 0)
+	{
+		int region = gPerf.stack[gPerf.depth - 1];
+		for (int c = 0; c < PERF_COUNTER_COUNT; ++c)
+			gPerf.frame[region][c] += now[c] - gPerf.last[c];
+	}
+	memcpy(gPerf.last, now, sizeof(now));
+	#endif
+}
+
+struct PerfScope
+{
+	bool active;
+	explicit PerfScope(PerfRegion region) : active(tPerfOwner && gPerf.enabled && gPerf.depth < PerfCounterState::kMaxDepth)
+	{
+		if (!active)
+			return;
+		perfCharge();
+		gPerf.stack[gPerf.depth++] = region;
+	}
+	~PerfScope()
+	{
+		if (!active)
+			return;
+		perfCharge();
+		gPerf.depth--;
+	}
+};
+
+#define PERF_REGION_CAT2(a, b) a##b
+#define PERF_REGION_CAT(a, b) PERF_REGION_CAT2(a, b)
+#define PERF_REGION(region) PerfScope PERF_REGION_CAT(perfScope_, __LINE__)(region)
+
+void perfFrameBegin()
+{
+	memset(gPerf.frame, 0, sizeof(gPerf.frame));
+}
+
+// Adds the frame to the totals when it counts towards the benchmark
+void perfFrameEnd(bool record)
+{
+	if (!gPerf.enabled || !record)
+		return;
+	for (int r = 0; r < PERF_REGION_COUNT; ++r)
+		for (int c = 0; c < PERF_COUNTER_COUNT; ++c)
+			gPerf.total[r][c] += gPerf.frame[r][c];
+	gPerf.frames++;
+}
+
+void perfCountersReset()
+{
+	memset(gPerf.total, 0, sizeof(gPerf.total));
+	gPerf.frames = 0;
+}
+
+// Counts summed over `frames` frames: the run's, or one stress step's
+static void writePerfCounters(FILE *out, const char *indent, const unsigned long long (*total)[PERF_COUNTER_COUNT],
+							  long long frames)
+{
+	if (!gPerf.enabled)
+	{
+		fprintf(out, "%s\"perf_counters\": {\"available\": false, \"error\": \"%s\"},\n", indent, gPerf.error.c_str());
+		return;
+	}
+
+	fprintf(out, "%s\"perf_counters\": {\n", indent);
+	fprintf(out, "%s  \"available\": true,\n", indent);
+	fprintf(out, "%s  \"error\": \"%s\",\n", indent, gPerf.error.c_str());
+	fprintf(out, "%s  \"frames\": %lld,\n", indent, frames);
+	frames = std::max(1LL, frames);
+	for (int r = 0; r < PERF_REGION_COUNT; ++r)
+	{
+		const unsigned long long *t = total[r];
+		fprintf(out, "%s  \"%s\": {", indent, kPerfRegionNames[r]);
+		for (int c = 0; c < PERF_COUNTER_COUNT; ++c)
+		{
+			if (gPerf.groupIndex[c] < 0)
+				fprintf(out, "\"%s\": null, ", kPerfCounterNames[c]);
+			else
+				fprintf(out, "\"%s\": {\"per_frame\": %.1f, \"total\": %llu}, ", kPerfCounterNames[c],
+						(double)t[c] / frames, t[c]);
+		}
+
+		// Derived ratios, null when an input is missing
+		bool ipc = gPerf.groupIndex[PERF_CYCLES] >= 0 && gPerf.groupIndex[PERF_INSTRUCTIONS] >= 0 && t[PERF_CYCLES] > 0;
+		bool perKilo = gPerf.groupIndex[PERF_INSTRUCTIONS] >= 0 && t[PERF_INSTRUCTIONS] > 0;
+		if (ipc)
+			fprintf(out, "\"ipc\": %.3f, ", (double)t[PERF_INSTRUCTIONS] / t[PERF_CYCLES]);
+		else
+			fprintf(out, "\"ipc\": null, ");
+		if (perKilo && gPerf.groupIndex[PERF_CACHE_MISSES] >= 0)
+			fprintf(out, "\"cache_mpki\": %.3f, ", 1000.0 * t[PERF_CACHE_MISSES] / t[PERF_INSTRUCTIONS]);
+		else
+			fprintf(out, "\"cache_mpki\": null, ");
+		if (perKilo && gPerf.groupIndex[PERF_BRANCH_MISSES] >= 0)
+			fprintf(out, "\"branch_mpki\": %.3f}", 1000.0 * t[PERF_BRANCH_MISSES] / t[PERF_INSTRUCTIONS]);
+		else
+			fprintf(out, "\"branch_mpki\": null}");
+		fprintf(out, "%s\n", r + 1 < PERF_REGION_COUNT ? "," : "");
+	}
+	fprintf(out, "%s},\n", indent);
+}
+
+// ---------------------------------------------------------------------------
+// Input queue
+//
+// GLFW callbacks run on the main (event) thread and only record what
+// happened, stamped with glfwGetTime(); whichever thread runs the simulation
+// applies them in order at the first step whose tick is not earlier than the
+// stamp. One producer, one consumer, a fixed ring: neither side locks or
+// allocates. When the ring is full new events are dropped and counted.
+//
+// Applied events are passed on to the renderer through a second ring. Each
+// RenderState counts the events applied so far, so once a frame showing that
+// state has been swapped, the events it newly reflects get their
+// input-to-present latency recorded.
+// ---------------------------------------------------------------------------
+
+enum InputEventType
+{
+	INPUT_KEY,
+	INPUT_CURSOR
+};
+
+struct InputEvent
+{
+	double time;     // glfwGetTime() in the callback
+	int type;        // InputEventType
+	int key;         // INPUT_KEY: GLFW key and action
+	int action;
+	float cursorX;   // INPUT_CURSOR: bunny x the cursor maps to
+};
+
+struct InputQueue
+{
+	static const unsigned kCapacity = 256;   // power of two
+
+	InputEvent events[kCapacity];
+	std::atomic<unsigned> head{0};   // next to pop; consumer
+	std::atomic<unsigned> tail{0};   // next to push; producer
+	std::atomic<unsigned> dropped{0};
+
+	bool push(const InputEvent &e)
+	{
+		unsigned t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == kCapacity)
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		events[t & (kCapacity - 1)] = e;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Takes the oldest event if it happened no later than `until`
+	bool pop(InputEvent &e, double until = HUGE_VAL)
+	{
+		unsigned h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+		const InputEvent &next = events[h & (kCapacity - 1)];
+		if (next.time > until)
+			return false;
+		e = next;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const
+	{
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+};
+InputQueue gInputQueue;     // callbacks -> simulation
+InputQueue gAppliedInput;   // simulation -> renderer, for latency
+
+// Input-to-present latency, bucketed. The last bucket is everything slower.
+static const int kInputLatencyBuckets = 12;
+static const float kInputLatencyBucketMs[kInputLatencyBuckets - 1] = {2, 4, 8, 12, 16, 20, 25, 33, 50, 67, 100};
+
+struct InputLatencyState
+{
+	static const int kWindow = 128;   // events in the rolling histogram
+
+	unsigned presented = 0;   // applied events whose frame has been swapped
+
+	unsigned char window[kWindow];   // bucket of each recent event
+	float windowMs[kWindow];
+	int windowHead = 0;
+	int windowCount = 0;
+	int histogram[kInputLatencyBuckets] = {};   // over the window
+};
+InputLatencyState gInputLatency;
+
+// Called for every measured event; the benchmark collects its samples here
+void onInputPresented(double latencyMs);
+
+static int inputLatencyBucket(float ms)
+{
+	int b = 0;
+	while (b < kInputLatencyBuckets - 1 && ms > kInputLatencyBucketMs[b])
+		b++;
+	return b;
+}
+
+// After the swap of a frame that drew `shown`: every event the simulation had
+// applied by then is on its way to the screen
+void inputLatencyFramePresented(const RenderState &shown, double presentTime)
+{
+	InputEvent e;
+	while (gInputLatency.presented != shown.inputApplied && gAppliedInput.pop(e))
+	{
+		gInputLatency.presented++;
+		float ms = (float)((presentTime - e.time) * 1000.0);
+		int slot = gInputLatency.windowHead;
+		if (gInputLatency.windowCount == InputLatencyState::kWindow)
+			gInputLatency.histogram[gInputLatency.window[slot]]--;
+		else
+			gInputLatency.windowCount++;
+		int bucket = inputLatencyBucket(ms);
+		gInputLatency.window[slot] = (unsigned char)bucket;
+		gInputLatency.windowMs[slot] = ms;
+		gInputLatency.histogram[bucket]++;
+		gInputLatency.windowHead = (slot + 1) % InputLatencyState::kWindow;
+		onInputPresented(ms);
+	}
+}
+
+// Mean and max over the rolling window
+void inputLatencyRollingStats(float &meanMs, float &maxMs)
+{
+	meanMs = maxMs = 0;
+	for (int i = 0; i < gInputLatency.windowCount; ++i)
+	{
+		meanMs += gInputLatency.windowMs[i];
+		maxMs = std::max(maxMs, gInputLatency.windowMs[i]);
+	}
+	if (gInputLatency.windowCount > 0)
+		meanMs /= gInputLatency.windowCount;
+}
+
+// ---------------------------------------------------------------------------
+// Frame pacing
+//
+// --pacing picks how frames are released to the display:
+//     vsync      swap every --swap-interval refreshes (default 1)
+//     adaptive   like vsync, but a late frame swaps at once and tears instead
+//                of waiting for the next refresh (swap_control_tear); plain
+//                vsync where the driver lacks it
+//     uncapped   no vsync and no limit; the benchmark default
+//     capped     no vsync; each swap waits, sleeping then spinning, until
+//                1/--fps-cap s after the previous one (default: refresh rate)
+// Every present-to-present interval is measured. One longer than 1.5 target
+// periods is a missed deadline; one more than twice the recent median, and at
+// least 2 ms over it, is a stutter, in any mode. The HUD and benchmark reports show the intervals'
+// mean and standard deviation and both counts.
+// ---------------------------------------------------------------------------
+
+enum PacingMode
+{
+	PACING_VSYNC,
+	PACING_ADAPTIVE,
+	PACING_UNCAPPED,
+	PACING_CAPPED,
+	PACING_MODE_COUNT
+};
+
+const char *kPacingModeNames[PACING_MODE_COUNT] = {"vsync", "adaptive", "uncapped", "capped"};
+
+static bool parsePacingMode(const string &name, int &mode)
+{
+	for (int i = 0; i < PACING_MODE_COUNT; ++i)
+	{
+		if (name == kPacingModeNames[i])
+		{
+			mode = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+// What pacingFramePresented() made of an interval
+enum PacingFlags
+{
+	PACING_MISSED = 1,
+	PACING_STUTTER = 2
+};
+
+struct FramePacingState
+{
+	static const int kWindow = 120;   // intervals in the rolling stats
+	static const int kMinForStutter = 8;
+	static constexpr float kStutterMinMs = 2.0f;   // sub-ms hiccups of an uncapped loop are not stutters
+
+	int mode = -1;               // PacingMode; -1 = vsync, or uncapped when benchmarking
+	int swapInterval = 1;        // --swap-interval, refreshes per swap in the vsync modes
+	double capFps = 0.0;         // --fps-cap; 0 = the refresh rate
+	double refreshPeriod = 1.0 / 60.0;   // seconds, from the primary monitor
+	double targetPeriod = 0.0;   // seconds between presents; 0 = no target
+
+	double lastPresent = -1.0;   // glfwGetTime() after the last swap returned
+	float lastIntervalMs = 0.0f;
+	float intervalMs[kWindow] = {};
+	int head = 0;
+	int count = 0;
+
+	long long presents = 0;
+	long long missedDeadlines = 0;
+	long long stutters = 0;
+};
+FramePacingState gPacing;
+
+// Sleeps to just short of t, then spins the rest for precision
+void waitUntil(double t)
+{
+	const double kSpin = 0.001;
+	double now = glfwGetTime();
+	if (t - now > kSpin)
+		std::this_thread::sleep_for(std::chrono::duration<double>(t - now - kSpin));
+	while (glfwGetTime() < t)
+	{
+	}
+}
+
+// Sets the swap interval for the mode; needs the current context
+void pacingInit(bool benchmark)
+{
+	if (const GLFWvidmode *video = glfwGetVideoMode(glfwGetPrimaryMonitor()))
+		if (video->refreshRate > 0)
+			gPacing.refreshPeriod = 1.0 / video->refreshRate;
+	// Benchmarks measure the frame, not the display refresh rate
+	if (gPacing.mode < 0)
+		gPacing.mode = benchmark ? PACING_UNCAPPED : PACING_VSYNC;
+
+	#ifndef __EMSCRIPTEN__
+	if (gPacing.mode == PACING_ADAPTIVE && !glfwExtensionSupported("WGL_EXT_swap_control_tear") &&
+		!glfwExtensionSupported("GLX_EXT_swap_control_tear"))
+	{
+		if (gDebugLogs)
+			fprintf(stderr, "No swap_control_tear; pacing falls back to vsync\n");
+		gPacing.mode = PACING_VSYNC;
+	}
+	#endif
+
+	int interval = 0;
+	gPacing.targetPeriod = 0.0;
+	if (gPacing.mode == PACING_VSYNC || gPacing.mode == PACING_ADAPTIVE)
+	{
+		interval = gPacing.mode == PACING_ADAPTIVE ? -gPacing.swapInterval : gPacing.swapInterval;
+		gPacing.targetPeriod = gPacing.refreshPeriod * gPacing.swapInterval;
+	}
+	else if (gPacing.mode == PACING_CAPPED)
+	{
+		gPacing.targetPeriod = gPacing.capFps > 0.0 ? 1.0 / gPacing.capFps : gPacing.refreshPeriod;
+	}
+	glfwSwapInterval(interval);
+}
+
+// Capped mode holds the swap until one period after the last present. The
+// browser paces the web build itself.
+void pacingBeforeSwap()
+{
+	#ifndef __EMSCRIPTEN__
+	if (gPacing.mode != PACING_CAPPED || gPacing.lastPresent < 0.0)
+		return;
+	PROFILE_SCOPE("pacingWait");
+	waitUntil(gPacing.lastPresent + gPacing.targetPeriod);
+	#endif
+}
+
+// Records the swap that returned at t; returns PacingFlags for its interval
+int pacingFramePresented(double t)
+{
+	double last = gPacing.lastPresent;
+	gPacing.lastPresent = t;
+	if (last < 0.0)
+		return 0;
+
+	float ms = (float)((t - last) * 1000.0);
+	int flags = 0;
+	if (gPacing.targetPeriod > 0.0 && ms > 1.5 * 1000.0 * gPacing.targetPeriod)
+	{
+		flags |= PACING_MISSED;
+		gPacing.missedDeadlines++;
+	}
+	if (gPacing.count >= FramePacingState::kMinForStutter)
+	{
+		float recent[FramePacingState::kWindow];
+		std::copy(gPacing.intervalMs, gPacing.intervalMs + gPacing.count, recent);
+		std::nth_element(recent, recent + gPacing.count / 2, recent + gPacing.count);
+		float median = recent[gPacing.count / 2];
+		if (ms > 2.0f * median && ms > median + FramePacingState::kStutterMinMs)
+		{
+			flags |= PACING_STUTTER;
+			gPacing.stutters++;
+		}
+	}
+
+	gPacing.lastIntervalMs = ms;
+	gPacing.intervalMs[gPacing.head] = ms;
+	gPacing.head = (gPacing.head + 1) % FramePacingState::kWindow;
+	gPacing.count = std::min(gPacing.count + 1, FramePacingState::kWindow);
+	gPacing.presents++;
+	return flags;
+}
+
+// Mean and standard deviation of the recent intervals
+void pacingRollingStats(float &meanMs, float &stddevMs)
+{
+	meanMs = stddevMs = 0;
+	if (gPacing.count == 0)
+		return;
+	for (int i = 0; i < gPacing.count; ++i)
+		meanMs += gPacing.intervalMs[i];
+	meanMs /= gPacing.count;
+	for (int i = 0; i < gPacing.count; ++i)
+		stddevMs += (gPacing.intervalMs[i] - meanMs) * (gPacing.intervalMs[i] - meanMs);
+	stddevMs = sqrtf(stddevMs / gPacing.count);
+}
+
+// ---------------------------------------------------------------------------
+// Low latency
+//
+// --low-latency late-latches mouse steering: right before the bunny's
+// transform is written to its uniform buffer, the newest cursor position is
+// sampled and the bunny is offset by how far the cursor moved since the last
+// cursor event the simulation applied. The simulation catches up at its next
+// step, so hits and score are unaffected. With vsync pacing, --render-lead
+// starts each frame that many ms before the next expected vsync instead of
+// right after the swap, so input is sampled closer to the refresh that shows
+// it.
+// ---------------------------------------------------------------------------
+
+struct LowLatencyState
+{
+	bool lateLatch = false;         // --low-latency
+	double renderLeadMs = -1.0;     // --render-lead; <0 = default, 0 = no wait
+
+	// Newest cursor position as bunny x. With a render thread the event
+	// thread publishes it; otherwise the cursor is queried directly.
+	bool queryCursor = true;
+	std::atomic<float> latestCursorX{-0.9f};
+};
+LowLatencyState gLowLatency;
+
+// Bunny x for a cursor fraction t of the way across the window
+float cursorToBunnyX(float t)
+{
+	return clampf(leftBound + t * (rightBound - leftBound), leftBound, rightBound);
+}
+
+// Where the bunny should be drawn, given the state the simulation produced
+float lateLatchedBunnyX(const RenderState &view)
+{
+	if (!gLowLatency.lateLatch || !useMouseControls || view.gamefinish != 0)
+		return view.translationX;
+
+	float latest;
+	if (gLowLatency.queryCursor)
+	{
+		double x, y;
+		int windowWidth, windowHeight;
+		glfwGetCursorPos(glfwGetCurrentContext(), &x, &y);
+		glfwGetWindowSize(glfwGetCurrentContext(), &windowWidth, &windowHeight);
+		if (windowWidth <= 0)
+			return view.translationX;
+		latest = cursorToBunnyX((float)(x / windowWidth));
+	}
+	else
+	{
+		latest = gLowLatency.latestCursorX.load(std::memory_order_relaxed);
+	}
+	return clampf(view.translationX + latest - view.cursorX, leftBound, rightBound);
+}
+
+// Writes the bunny's transform just before its draw
+void bunnyTransformUpload(const glm::mat4 &m)
+{
+	statBindBuffer(GL_UNIFORM_BUFFER, gBunnyTransformUbo);
+	statBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(m), glm::value_ptr(m));
+}
+
+// Holds the frame start until renderLeadMs before the next expected vsync
+void renderDeadlineWait()
+{
+	bool vsync = gPacing.mode == PACING_VSYNC || gPacing.mode == PACING_ADAPTIVE;
+	if (gLowLatency.renderLeadMs <= 0.0 || !vsync || gPacing.lastPresent < 0.0)
+		return;
+	PROFILE_SCOPE("renderDeadlineWait");
+	waitUntil(gPacing.lastPresent + gPacing.targetPeriod - gLowLatency.renderLeadMs / 1000.0);
+}
+
+// ---------------------------------------------------------------------------
+// Power saving
+//
+// Outside benchmarks the game renders on demand once nothing can change on
+// screen: after a game over, while paused (P), and while the window is
+// unfocused or minimized. The simulation stops stepping in those states
+// (after a game over it still steps for queued input, so R works) and the
+// renderer draws for a short settle period after every change, then blocks:
+// in glfwWaitEventsTimeout() when it polls events itself, otherwise on a
+// condition variable that every input and window event signals. Play resumes
+// on the next event: R, P, focus, restore. --no-idle keeps rendering every
+// frame.
+// ---------------------------------------------------------------------------
+
+enum PowerMode
+{
+	POWER_ACTIVE,
+	POWER_GAME_OVER,
+	POWER_PAUSED,
+	POWER_UNFOCUSED,
+	POWER_MINIMIZED,
+	POWER_MODE_COUNT
+};
+
+const char *kPowerModeNames[POWER_MODE_COUNT] = {"active", "game-over", "paused", "unfocused", "minimized"};
+
+struct PowerSaveState
+{
+	static constexpr double kIdleTimeout = 0.5;   // s; longest block without any event
+	static constexpr double kSettle = 0.1;        // s of frames after a change
+
+	bool disabled = false;   // --no-idle, and always for benchmarks
+	std::atomic<bool> paused{false};
+	std::atomic<bool> focused{true};
+	std::atomic<bool> iconified{false};
+
+	// Bumped by every event that may change what is on screen
+	std::atomic<unsigned> wakes{0};
+	std::mutex mutex;
+	std::condition_variable wake;
+
+	// Renderer side
+	int mode = POWER_ACTIVE;
+	unsigned seenWakes = 0;
+	double settleUntil = 0.0;
+};
+PowerSaveState gPower;
+
+void powerWake()
+{
+	{
+		std::lock_guard<std::mutex> lock(gPower.mutex);
+		gPower.wakes.fetch_add(1, std::memory_order_release);
+	}
+	gPower.wake.notify_all();
+}
+
+// Blocks until an event arrives after `seen` or timeout seconds pass
+void powerWaitForWake(unsigned &seen, double timeout)
+{
+	std::unique_lock<std::mutex> lock(gPower.mutex);
+	gPower.wake.wait_for(lock, std::chrono::duration<double>(timeout),
+						 [&]() { return gPower.wakes.load(std::memory_order_acquire) != seen; });
+	seen = gPower.wakes.load(std::memory_order_acquire);
+}
+
+// Whether the game is held (paused, unfocused, minimized)
+bool powerHeld()
+{
+	return !gPower.disabled && (gPower.paused.load(std::memory_order_relaxed) ||
+								!gPower.focused.load(std::memory_order_relaxed) ||
+								gPower.iconified.load(std::memory_order_relaxed));
+}
+
+// Whether the simulation has nothing to do this step. Called where the
+// simulation runs, so it may read gamefinish.
+bool powerSimulationIdle()
+{
+	if (gPower.disabled)
+		return false;
+	return powerHeld() || (gamefinish != 0 && gInputQueue.empty());
+}
+
+int powerMode(int gameOver)
+{
+	if (gPower.disabled)
+		return POWER_ACTIVE;
+	if (gPower.iconified.load(std::memory_order_relaxed))
+		return POWER_MINIMIZED;
+	if (!gPower.focused.load(std::memory_order_relaxed))
+		return POWER_UNFOCUSED;
+	if (gPower.paused.load(std::memory_order_relaxed))
+		return POWER_PAUSED;
+	return gameOver ? POWER_GAME_OVER : POWER_ACTIVE;
+}
+
+// Called before each frame on the render side; returns true when the frame
+// should be skipped, having blocked for events meanwhile. pollsEvents is
+// whether this thread is the one that has to dispatch them.
+bool powerSkipFrame(int gameOver, bool pollsEvents)
+{
+	int mode = powerMode(gameOver);
+	if (mode == POWER_ACTIVE)
+	{
+		gPower.mode = mode;
+		return false;
+	}
+
+	unsigned wakes = gPower.wakes.load(std::memory_order_acquire);
+	double now = glfwGetTime();
+	if (mode != gPower.mode || wakes != gPower.seenWakes)
+	{
+		if (gDebugLogs && mode != gPower.mode)
+			fprintf(stderr, "Power: %s\n", kPowerModeNames[mode]);
+		gPower.mode = mode;
+		gPower.seenWakes = wakes;
+		gPower.settleUntil = mode == POWER_MINIMIZED ? now : now + PowerSaveState::kSettle;
+	}
+	if (now < gPower.settleUntil)
+		return false;
+
+	// The browser drives the web build; it only gets frames to skip
+	#ifndef __EMSCRIPTEN__
+	PROFILE_SCOPE("powerIdle");
+	if (pollsEvents)
+		glfwWaitEventsTimeout(PowerSaveState::kIdleTimeout);
+	else
+		powerWaitForWake(wakes, PowerSaveState::kIdleTimeout);
+	#endif
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+// Simulation
+//
+// Gameplay advances in fixed steps of 1/60 s, however fast frames are
+// rendered, and display() draws the state blended between the last two steps.
+// That costs up to one step of latency in exchange for motion that is smooth
+// at any frame rate. --sim-hz changes the step; per-step amounts are scaled
+// to it, so the game plays at the same speed at any rate.
+//
+// Natively the steps run on their own thread, paced by the clock. Each step
+// publishes a snapshot through a lock-free triple buffer and the render loop
+// takes the newest one without waiting, so vsync or driver stalls never slow
+// the game and a slow step never holds up a frame. Input reaches the steps
+// through gInputQueue. The web build and --no-sim-thread step on
+// the render thread from an accumulator instead, and benchmarks step exactly
+// once per frame there so their results stay deterministic.
+// ---------------------------------------------------------------------------
+
+// One step as the renderer sees it
+struct SimSnapshot
+{
+	RenderState previous;
+	RenderState current;
+	double stepTime;     // glfwGetTime() at which current is exact
+};
+
+// Single producer, single consumer, never blocks. Each side owns one slot
+// and the third is swapped through `middle`, whose kFresh bit marks a
+// snapshot the reader has not taken yet.
+struct SimSnapshotBuffer
+{
+	static const unsigned kFresh = 4;
+
+	SimSnapshot slots[3];
+	std::atomic<unsigned> middle{1};
+	unsigned back = 0;    // simulation thread
+	unsigned front = 2;   // render thread
+
+	SimSnapshot &writeSlot() { return slots[back]; }
+
+	void publish()
+	{
+		back = middle.exchange(back | kFresh, std::memory_order_acq_rel) & 3;
+	}
+
+	// Newest snapshot, or the last one again if no step finished since
+	const SimSnapshot &latest()
+	{
+		if (middle.load(std::memory_order_relaxed) & kFresh)
+			front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+		return slots[front];
+	}
+};
+
+struct SimulationState
+{
+	static const int kMaxStepsPerFrame = 8;   // after a long stall, drop time instead of catching up
+
+	double step = 1.0 / 60.0;   // seconds
+	double accumulator = 0.0;
+	double lastTime = -1.0;
+	bool snap = true;           // next frame must not blend (start)
+	long long steps = 0;
+
+	RenderState previous;
+	RenderState current;
+	RenderState view;           // what display() draws
+
+	bool threadDisabled = false;  // --no-sim-thread
+	bool threaded = false;
+	std::thread thread;
+	std::atomic<bool> running{false};
+	SimSnapshotBuffer snapshots;
+};
+SimulationState gSim;
+
+void resetGame()
+{
+	    score=0;
+	    scoreCarry=0;
+	    gamefinish=0;
+        translationX = -0.9f; // Initialize it to 0.0 initially
+        rotateX = -90;	   // Initialize it to 0.0 initially
+        rotateZ = 0;	   // Initialize it to 0.0 initially
+        speed= 0.45f;
+        isJumping = false;
+        up_down= true;
+        isAPressed = false;
+        isDPressed = false;
+        isxPressed=false;
+        jumpHeight = -6.2f; // Adjust the jump height as needed
+        jumpVelocity = -0.045f;
+        roadVelocity = +0.4f;
+        gSweep.valid = false;
+        obstacleStreamNewGame(roadVelocity);
+}
+
+// Replay hooks, see the Replay section. Ticks count the steps run so far.
+bool replayPlaying();
+bool replayNextEvent(long long tick, InputEvent &e);
+void replayRecordEvent(long long tick, const InputEvent &e);
+void replayStepDone(long long steps);
+
+static void simulationApplyEvent(const InputEvent &e)
+{
+	replayRecordEvent(gSim.steps, e);
+	if (e.type == INPUT_CURSOR)
+		translationX = cursorX = e.cursorX;
+	else if (e.key == GLFW_KEY_A)
+		isAPressed = (e.action == GLFW_PRESS || e.action == GLFW_REPEAT);
+	else if (e.key == GLFW_KEY_D)
+		isDPressed = (e.action == GLFW_PRESS || e.action == GLFW_REPEAT);
+	else if (e.key == GLFW_KEY_X)
+		isxPressed = (e.action == GLFW_PRESS || e.action == GLFW_REPEAT);
+	else if (e.key == GLFW_KEY_R && e.action == GLFW_PRESS)
+		resetGame();
+}
+
+// Applies, in arrival order, the queued input stamped no later than tick.
+// A replay supplies this step's events instead and live input is dropped.
+void simulationApplyInput(double tick)
+{
+	InputEvent e;
+	if (replayPlaying())
+	{
+		while (gInputQueue.pop(e))
+		{
+		}
+		while (replayNextEvent(gSim.steps, e))
+			simulationApplyEvent(e);
+		return;
+	}
+	while (gInputQueue.pop(e, tick))
+	{
+		if (gAppliedInput.push(e))
+			inputApplied++;
+		simulationApplyEvent(e);
+	}
+}
+
+// Input that arrives while the game is held is stale by the time play
+// resumes. Cursor moves are dropped; keys only update what is held down, and
+// neither counts toward input latency. Called by whichever thread steps.
+void simulationDropHeldInput()
+{
+	InputEvent e;
+	while (gInputQueue.pop(e))
+		if (e.type == INPUT_KEY)
+			simulationApplyEvent(e);
+}
+
+void simulationStep()
+{
+    PROFILE_SCOPE("simulation.step");
+    PERF_REGION(PERF_SIMULATION);
+    glm::mat4 bunny = bunnyModelingMatrix();
+
+    // Spawn obstacle rows that have come round to the far end of the
+    // track, then scroll the pool to this tick
+    obstacleStreamAdvance(roadVelocity);
+    EntityStore &pool = gObstacleStream.pool;
+    entityScroll(pool, 0, pool.count, roadVelocity);
+
+    // Every per-step amount below is tuned for 60 steps a second; k scales
+    // it to --sim-hz so the game plays at the same speed at any rate
+    float k = (float)(gSim.step * 60.0);
+
+    // Everything the bunny swept past since the previous tick
+    sweptObstacleHits(bunny, roadVelocity, [&](int e, bool bonusOnly) {
+            if(pool.flags[e] & ENTITY_BONUS){
+                isLoop = true;
+                scoreCarry+=200*k;   // per 1/60 s spent over the bonus
+            }
+            else if (!bonusOnly) {
+                gamefinish+=1;
+                if(gamefinish==1){
+                    variable=pool.lane[e];
+                }
+            }
+    });
+
+    if(gamefinish==0)
+        scoreCarry += k;
+    int points = (int)scoreCarry;
+    score += points;
+    scoreCarry -= points;
+    if(gamefinish==0){
+        roadVelocity+=(score/2500+1)*0.00009f*1000*gRoadSpeedScale*k ;
+        jumpVelocity -= 0.00003f*k;
+        if(jumpHeight <= -6.2f)
+        up_down=true;
+        else if(jumpHeight > -5.6f)
+            up_down=false;
+
+        if (isAPressed) {
+            // Translate left
+            translationX -= speed*k; // speed is a constant or variable determining movement speed
+        }
+        if (isDPressed) {
+            // Translate right
+            translationX += speed*k ;
+        }
+        if(up_down==true) //Eðer yukarý dooðru çýkýyorsa.
+            jumpHeight -= jumpVelocity*k;
+        else if(up_down==false) //Eðer aþaðý iniyorsa.
+            jumpHeight += jumpVelocity*k;
+        translationX = std::max(leftBound, std::min(translationX, rightBound));
+
+        if(isxPressed)
+        {
+            isLoop=true;
+        }
+        if(isLoop)
+        {
+            rotateX +=rotate_velocity*k;
+
+        }
+        if(rotateX>270)
+        {
+            rotateX=-90;
+            isLoop=false;
+
+        }
+    }
+    else
+    {
+        jumpHeight=-6.2f;
+        rotateZ =-90;
+    }
+}
+
+static float lerpf(float a, float b, float t)
+{
+	return a + (b - a) * t;
+}
+
+// Sets gSim.view to the state t of the way from a to b
+static void simulationBlend(const RenderState &a, const RenderState &b, float t)
+{
+	gSim.view = b;
+	gSim.view.roadVelocity = lerpf(a.roadVelocity, b.roadVelocity, t);
+	gSim.view.translationX = lerpf(a.translationX, b.translationX, t);
+	gSim.view.jumpHeight = lerpf(a.jumpHeight, b.jumpHeight, t);
+	// The loop wraps from 270 back to -90 degrees; never blend across it
+	gSim.view.rotateX = b.rotateX >= a.rotateX ? lerpf(a.rotateX, b.rotateX, t) : b.rotateX;
+}
+
+// Runs the steps that fit into elapsed seconds, which end at `now`, on the
+// calling thread
+void simulationAdvance(double elapsed, double now)
+{
+	if (gSim.snap)
+	{
+		gSim.previous = gSim.current = captureRenderState();
+		gSim.accumulator = 0.0;
+		gSim.snap = false;
+	}
+
+	gSim.accumulator += std::min(std::max(elapsed, 0.0), gSim.step * SimulationState::kMaxStepsPerFrame);
+	while (gSim.accumulator >= gSim.step)
+	{
+		simulationApplyInput(now - (gSim.accumulator - gSim.step));
+		gSim.previous = captureRenderState();
+		simulationStep();
+		gSim.accumulator -= gSim.step;
+		replayStepDone(++gSim.steps);
+	}
+	gSim.current = captureRenderState();
+	simulationBlend(gSim.previous, gSim.current, (float)(gSim.accumulator / gSim.step));
+}
+
+static void simulationThreadMain()
+{
+	profileSetThreadName("simulation");
+	double next = glfwGetTime() + gSim.step;
+	unsigned seenWakes = gPower.wakes.load(std::memory_order_acquire);
+	while (gSim.running.load(std::memory_order_acquire))
+	{
+		if (powerSimulationIdle())
+		{
+			if (powerHeld())
+				simulationDropHeldInput();
+			powerWaitForWake(seenWakes, PowerSaveState::kIdleTimeout);
+			next = glfwGetTime();
+			continue;
+		}
+		double now = glfwGetTime();
+		if (now < next)
+		{
+			std::this_thread::sleep_for(std::chrono::duration<double>(next - now));
+			continue;
+		}
+		if (now - next > gSim.step * SimulationState::kMaxStepsPerFrame)
+			next = now;
+
+		SimSnapshot &snapshot = gSim.snapshots.writeSlot();
+		simulationApplyInput(next);
+		snapshot.previous = captureRenderState();
+		simulationStep();
+		snapshot.current = captureRenderState();
+		snapshot.stepTime = next;
+		gSim.snapshots.publish();
+		replayStepDone(++gSim.steps);
+		next += gSim.step;
+	}
+}
+
+void simulationStartThread()
+{
+	#ifndef __EMSCRIPTEN__
+	SimSnapshot initial;
+	initial.previous = initial.current = captureRenderState();
+	initial.stepTime = glfwGetTime();
+	for (int i = 0; i < 3; ++i)
+		gSim.snapshots.slots[i] = initial;
+
+	gSim.running.store(true, std::memory_order_release);
+	gSim.thread = std::thread(simulationThreadMain);
+	gSim.threaded = true;
+	#endif
+}
+
+void simulationStopThread()
+{
+	if (!gSim.threaded)
+		return;
+	gSim.running.store(false, std::memory_order_release);
+	powerWake();
+	gSim.thread.join();
+	gSim.threaded = false;
+}
+
+// Prepares gSim.view for the frame about to be drawn. With the thread that is
+// the newest snapshot blended by the time since its step; otherwise the steps
+// run here, by wall time or exactly one per frame when lockstep (benchmarks).
+void simulationFrame(bool lockstep)
+{
+	if (gSim.threaded)
+	{
+		const SimSnapshot &snapshot = gSim.snapshots.latest();
+		float t = (float)((glfwGetTime() - snapshot.stepTime) / gSim.step);
+		simulationBlend(snapshot.previous, snapshot.current, std::min(std::max(t, 0.0f), 1.0f));
+		return;
+	}
+	if (lockstep)
+	{
+		// Scripted input was queued for this very frame
+		simulationAdvance(gSim.step, HUGE_VAL);
+		return;
+	}
+	double now = glfwGetTime();
+	double elapsed = gSim.lastTime < 0.0 || powerSimulationIdle() ? 0.0 : now - gSim.lastTime;
+	gSim.lastTime = now;
+	simulationAdvance(elapsed, now);
+}
+
+// ---------------------------------------------------------------------------
+// Replay
+//
+// --record <file> logs every input event the simulation applies, stamped with
+// the tick it was applied before, together with the seed and every setting
+// the steps depend on. --replay <file> plays such a log back: live input is
+// ignored, each event is applied right before its tick, and the game runs
+// exactly as recorded, down to the bit. The recorder also writes a hash of
+// the simulation state every kCheckpointTicks steps and at the end, which
+// playback compares against its own, so a divergence is reported at the
+// checkpoint it first shows up in.
+//
+// --fast-forward <tick> steps the replay up to that tick before the first
+// frame, uncapped and without drawing; `end` plays all of it, prints the
+// result and exits. With --benchmark the replay drives the run instead of an
+// --input script, for as many frames as it has ticks unless --frames is set.
+//
+// The file is a header (magic, version, settings) followed by records of a
+// type byte, the tick as a LEB128 delta from the previous record and a
+// payload: key and action, the cursor x, or a state hash. All fixed-width
+// fields are little-endian.
+// ---------------------------------------------------------------------------
+
+enum ReplayRecordType
+{
+	REPLAY_KEY = 1,    // u16 key, u8 action
+	REPLAY_CURSOR,     // f32 cursor x
+	REPLAY_CHECKPOINT, // u64 state hash after the tick
+	REPLAY_END         // u64 state hash; the tick is the length of the log
+};
+
+static const char kReplayMagic[4] = {'B', 'R', 'P', 'L'};
+static const unsigned kReplayVersion = 1;
+
+struct ReplayRecord
+{
+	int type = 0;        // 0 past the last record
+	long long tick = 0;
+	InputEvent event;
+	unsigned long long hash = 0;
+};
+
+struct ReplayState
+{
+	static const long long kCheckpointTicks = 600;
+
+	// Recording
+	string recordPath;
+	FILE *out = NULL;
+	long long recordTick = 0;      // tick of the last record written
+	char outBuffer[1 << 16];       // stdio buffer, so writing never allocates
+
+	// Playback
+	string path;
+	bool playing = false;
+	vector<unsigned char> log;
+	size_t pos = 0;                // after `next`
+	ReplayRecord next;
+	long long ticks = 0;           // length of the log
+	long long fastForward = 0;     // --fast-forward; -1 = to the end
+	bool finished = false;
+	int checked = 0;               // hashes compared
+	long long divergedAt = -1;     // first tick whose hash differed
+};
+ReplayState gReplay;
+
+static unsigned long long replayHashBytes(unsigned long long h, const void *data, size_t size)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	for (size_t i = 0; i < size; ++i)
+		h = (h ^ p[i]) * 1099511628211ULL;
+	return h;
+}
+
+// FNV-1a over every bit of state a step carries over to the next
+unsigned long long simulationStateHash()
+{
+	float f[] = {roadVelocity, translationX, cursorX, jumpHeight, jumpVelocity, rotateX, rotateZ,
+				 scoreCarry, gSweep.scroll, gSweep.bunnyX};
+	int i[] = {score, gamefinish, variable, up_down, isLoop, isAPressed, isDPressed, isxPressed, gSweep.valid};
+	const EntityStore &pool = gObstacleStream.pool;
+	unsigned long long h = 14695981039346656037ULL;
+	h = replayHashBytes(h, f, sizeof(f));
+	h = replayHashBytes(h, i, sizeof(i));
+	h = replayHashBytes(h, &obstacleKey, sizeof(obstacleKey));
+	h = replayHashBytes(h, pool.posX.data(), pool.count * sizeof(float));
+	h = replayHashBytes(h, pool.posZ.data(), pool.count * sizeof(float));
+	h = replayHashBytes(h, pool.flags.data(), pool.count);
+	return h;
+}
+
+static void replayPut(unsigned char *&p, unsigned long long v, int bytes)
+{
+	for (int b = 0; b < bytes; ++b, v >>= 8)
+		*p++ = (unsigned char)v;
+}
+
+static void replayPutVarint(unsigned char *&p, unsigned long long v)
+{
+	for (; v >= 0x80; v >>= 7)
+		*p++ = (unsigned char)(v | 0x80);
+	*p++ = (unsigned char)v;
+}
+
+static bool replayGet(size_t &pos, unsigned long long &v, int bytes)
+{
+	if (gReplay.log.size() - pos < (size_t)bytes)
+		return false;
+	v = 0;
+	for (int b = 0; b < bytes; ++b)
+		v |= (unsigned long long)gReplay.log[pos++] << (8 * b);
+	return true;
+}
+
+static bool replayGetVarint(size_t &pos, unsigned long long &v)
+{
+	v = 0;
+	for (int shift = 0; pos < gReplay.log.size() && shift < 64; shift += 7)
+	{
+		unsigned char c = gReplay.log[pos++];
+		v |= (unsigned long long)(c & 0x7F) << shift;
+		if (!(c & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static float replayFloat(unsigned long long bits)
+{
+	unsigned u = (unsigned)bits;
+	float f;
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+
+static unsigned long long replayFloatBits(float f)
+{
+	unsigned u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+// Decodes the record at pos into r. False at the end of the log or on a
+// truncated or unknown record.
+static bool replayDecode(size_t &pos, long long tick, ReplayRecord &r)
+{
+	r.type = 0;
+	if (pos >= gReplay.log.size())
+		return false;
+	int type = gReplay.log[pos++];
+	unsigned long long delta, v;
+	if (!replayGetVarint(pos, delta))
+		return false;
+	r.tick = tick + (long long)delta;
+	r.event = InputEvent();
+	if (type == REPLAY_KEY && replayGet(pos, v, 3))
+	{
+		r.event.type = INPUT_KEY;
+		r.event.key = (int)(v & 0xFFFF);
+		r.event.action = (int)(v >> 16);
+	}
+	else if (type == REPLAY_CURSOR && replayGet(pos, v, 4))
+	{
+		r.event.type = INPUT_CURSOR;
+		r.event.cursorX = replayFloat(v);
+	}
+	else if (!((type == REPLAY_CHECKPOINT || type == REPLAY_END) && replayGet(pos, r.hash, 8)))
+		return false;
+	r.type = type;
+	return true;
+}
+
+static void replayWrite(int type, long long tick, unsigned long long payload, int payloadBytes)
+{
+	unsigned char record[32], *p = record;
+	*p++ = (unsigned char)type;
+	replayPutVarint(p, (unsigned long long)(tick - gReplay.recordTick));
+	replayPut(p, payload, payloadBytes);
+	fwrite(record, 1, p - record, gReplay.out);
+	gReplay.recordTick = tick;
+}
+
+// Opens the --record file and writes the header; after parseArgs, so the
+// settings are final
+bool replayRecordStart(unsigned seed)
+{
+	gReplay.out = fopen(gReplay.recordPath.c_str(), "wb");
+	if (!gReplay.out)
+		return false;
+	setvbuf(gReplay.out, gReplay.outBuffer, _IOFBF, sizeof(gReplay.outBuffer));
+
+	unsigned long long step;
+	memcpy(&step, &gSim.step, sizeof(step));
+	unsigned char header[64], *p = header;
+	memcpy(p, kReplayMagic, 4);
+	p += 4;
+	replayPut(p, kReplayVersion, 1);
+	replayPut(p, seed, 4);
+	replayPut(p, step, 8);
+	replayPut(p, (unsigned)gLaneCount, 4);
+	replayPut(p, (unsigned)gTileCount, 4);
+	replayPut(p, (unsigned)gObstacleRowStride, 4);
+	replayPut(p, replayFloatBits(gRoadSpeedScale), 4);
+	replayPut(p, gPreciseCollision, 1);
+	fwrite(header, 1, p - header, gReplay.out);
+	gReplay.recordTick = 0;
+	return true;
+}
+
+// Writes the final hash after `steps` ticks and closes the file
+void replayRecordFinish(long long steps)
+{
+	if (!gReplay.out)
+		return;
+	replayWrite(REPLAY_END, steps, simulationStateHash(), 8);
+	fclose(gReplay.out);
+	gReplay.out = NULL;
+}
+
+void replayRecordEvent(long long tick, const InputEvent &e)
+{
+	if (!gReplay.out)
+		return;
+	if (e.type == INPUT_CURSOR)
+		replayWrite(REPLAY_CURSOR, tick, replayFloatBits(e.cursorX), 4);
+	else
+		replayWrite(REPLAY_KEY, tick, (unsigned)(e.key & 0xFFFF) | (unsigned)(e.action & 0xFF) << 16, 3);
+}
+
+// Reads a --replay log, checks every record and adopts its settings, the
+// seed into `seed`
+bool replayLoad(const string &fileName, unsigned &seed)
+{
+	FILE *in = fopen(fileName.c_str(), "rb");
+	if (!in)
+		return false;
+	unsigned char chunk[4096];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+		gReplay.log.insert(gReplay.log.end(), chunk, chunk + n);
+	fclose(in);
+
+	size_t pos = 4;
+	unsigned long long version, logSeed, step, lanes, tiles, stride, roadSpeed, precise;
+	if (gReplay.log.size() < 4 || memcmp(gReplay.log.data(), kReplayMagic, 4) != 0 ||
+		!replayGet(pos, version, 1) || version != kReplayVersion || !replayGet(pos, logSeed, 4) ||
+		!replayGet(pos, step, 8) || !replayGet(pos, lanes, 4) || !replayGet(pos, tiles, 4) ||
+		!replayGet(pos, stride, 4) || !replayGet(pos, roadSpeed, 4) || !replayGet(pos, precise, 1))
+	{
+		fprintf(stderr, "Not a replay log: %s\n", fileName.c_str());
+		return false;
+	}
+	seed = (unsigned)logSeed;
+	memcpy(&gSim.step, &step, sizeof(step));
+	gLaneCount = (int)lanes;
+	gTileCount = (int)tiles;
+	gObstacleRowStride = (int)stride;
+	gRoadSpeedScale = replayFloat(roadSpeed);
+	gPreciseCollision = precise != 0;
+
+	// A log cut short (the recorder crashed) still plays up to where it ends
+	size_t first = pos;
+	ReplayRecord r;
+	long long tick = 0;
+	while (replayDecode(pos, tick, r) && r.type != REPLAY_END)
+		tick = r.tick;
+	if (r.type == REPLAY_END)
+		tick = r.tick;
+	else if (pos < gReplay.log.size() && gDebugLogs)
+		fprintf(stderr, "Replay log damaged after tick %lld\n", tick);
+	gReplay.log.resize(pos);
+
+	gReplay.ticks = tick;
+	gReplay.path = fileName;
+	gReplay.playing = true;
+	gReplay.pos = first;
+	replayDecode(gReplay.pos, 0, gReplay.next);
+	return true;
+}
+
+bool replayPlaying()
+{
+	return gReplay.playing;
+}
+
+// Takes the next logged event due before step `tick`
+bool replayNextEvent(long long tick, InputEvent &e)
+{
+	ReplayRecord &next = gReplay.next;
+	if (next.tick > tick || (next.type != REPLAY_KEY && next.type != REPLAY_CURSOR))
+		return false;
+	e = next.event;
+	replayDecode(gReplay.pos, next.tick, next);
+	return true;
+}
+
+// After every step: the recorder writes checkpoints, playback checks them
+void replayStepDone(long long steps)
+{
+	if (gReplay.out && steps % ReplayState::kCheckpointTicks == 0)
+		replayWrite(REPLAY_CHECKPOINT, steps, simulationStateHash(), 8);
+
+	ReplayRecord &next = gReplay.next;
+	while (gReplay.playing && (next.type == REPLAY_CHECKPOINT || next.type == REPLAY_END) && next.tick <= steps)
+	{
+		if (next.tick == steps)
+		{
+			gReplay.checked++;
+			if (next.hash != simulationStateHash() && gReplay.divergedAt < 0)
+			{
+				gReplay.divergedAt = steps;
+				fprintf(stderr, "Replay diverged from %s at tick %lld\n", gReplay.path.c_str(), steps);
+			}
+		}
+		if (next.type == REPLAY_END)
+		{
+			gReplay.finished = true;
+			if (gDebugLogs && gReplay.divergedAt < 0)
+				fprintf(stderr, "Replay matched %s over %lld ticks\n", gReplay.path.c_str(), steps);
+		}
+		replayDecode(gReplay.pos, next.tick, next);
+	}
+}
+
+// --fast-forward: runs the replay up to `target` (-1 = its end) here and
+// now, as fast as the steps go and drawing nothing
+void replayFastForward(long long target)
+{
+	if (target < 0 || target > gReplay.ticks)
+		target = gReplay.ticks;
+	double start = glfwGetTime();
+	long long first = gSim.steps;
+	while (gSim.steps < target)
+	{
+		simulationApplyInput(HUGE_VAL);
+		simulationStep();
+		replayStepDone(++gSim.steps);
+	}
+	gSim.snap = true;
+
+	double seconds = glfwGetTime() - start;
+	if (gDebugLogs || gReplay.fastForward < 0)
+		printf("Replay %s: %lld ticks in %.3f s (%.0f ticks/s), score %d, %s\n", gReplay.path.c_str(),
+			   gSim.steps - first, seconds, (gSim.steps - first) / std::max(seconds, 1e-9), score,
+			   gReplay.divergedAt >= 0 ? "diverged" : gReplay.checked > 0 ? "matched" : "unchecked");
+}
+
+// ---------------------------------------------------------------------------
+// HUD
+//
+// --hud, or H in game, overlays the score, a frame-time graph, GPU pass times
+// and the renderer counters. Text uses a 5x7 font baked into a small R8 atlas
+// at startup. Every glyph, bar and panel is a quad in one dynamic vertex
+// buffer, drawn with a single glDrawArrays.
+// ---------------------------------------------------------------------------
+
+#ifdef __EMSCRIPTEN__
+#define HUD_GLSL_HEADER "#version 300 es\nprecision highp float;\n"
+#else
+#define HUD_GLSL_HEADER "#version 330 core\n"
+#endif
+
+const GLchar *hudVertexShaderSrc = HUD_GLSL_HEADER R"glsl(
+layout (location = 0) in vec2 position;   // pixels, origin at the top left
+layout (location = 1) in vec2 texCoords;
+layout (location = 2) in vec4 color;
+uniform vec2 viewport;
+out vec2 TexCoords;
+out vec4 Color;
+
+void main() {
+    gl_Position = vec4(position.x / viewport.x * 2.0 - 1.0, 1.0 - position.y / viewport.y * 2.0, 0.0, 1.0);
+    TexCoords = texCoords;
+    Color = color;
+}
+)glsl";
+
+const GLchar *hudFragmentShaderSrc = HUD_GLSL_HEADER R"glsl(
+in vec2 TexCoords;
+in vec4 Color;
+out vec4 fragColor;
+uniform sampler2D atlas;
+
+void main() {
+    fragColor = vec4(Color.rgb, Color.a * texture(atlas, TexCoords).r);
+}
+)glsl";
+
+// Glyphs for ASCII 32..95, one byte per row, bit 4 is the leftmost pixel.
+// Lower-case letters are drawn with the upper-case glyphs.
+const unsigned char kHudFont[64][7] = {
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // ' '
+	{0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04},  // '!'
+	{0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00},  // '"'
+	{0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A},  // '#'
+	{0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04},  // '$'
+	{0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03},  // '%'
+	{0x08, 0x14, 0x14, 0x08, 0x15, 0x12, 0x0D},  // '&'
+	{0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00},  // '''
+	{0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02},  // '('
+	{0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08},  // ')'
+	{0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00},  // '*'
+	{0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00},  // '+'
+	{0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08},  // ','
+	{0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00},  // '-'
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C},  // '.'
+	{0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00},  // '/'
+	{0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E},  // '0'
+	{0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},  // '1'
+	{0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F},  // '2'
+	{0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},  // '3'
+	{0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02},  // '4'
+	{0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},  // '5'
+	{0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E},  // '6'
+	{0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},  // '7'
+	{0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E},  // '8'
+	{0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},  // '9'
+	{0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00},  // ':'
+	{0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08},  // ';'
+	{0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02},  // '<'
+	{0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00},  // '='
+	{0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08},  // '>'
+	{0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04},  // '?'
+	{0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E},  // '@'
+	{0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},  // 'A'
+	{0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E},  // 'B'
+	{0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E},  // 'C'
+	{0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C},  // 'D'
+	{0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F},  // 'E'
+	{0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10},  // 'F'
+	{0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F},  // 'G'
+	{0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},  // 'H'
+	{0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E},  // 'I'
+	{0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C},  // 'J'
+	{0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11},  // 'K'
+	{0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F},  // 'L'
+	{0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11},  // 'M'
+	{0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},  // 'N'
+	{0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},  // 'O'
+	{0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10},  // 'P'
+	{0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D},  // 'Q'
+	{0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11},  // 'R'
+	{0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E},  // 'S'
+	{0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},  // 'T'
+	{0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},  // 'U'
+	{0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04},  // 'V'
+	{0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A},  // 'W'
+	{0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11},  // 'X'
+	{0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04},  // 'Y'
+	{0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F},  // 'Z'
+	{0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E},  // '['
+	{0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00},  // backslash
+	{0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E},  // ']'
+	{0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00},  // '^'
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F},  // '_'
+};
+
+struct HudColor
+{
+	unsigned char r, g, b, a;
+};
+
+const HudColor kHudText = {235, 235, 235, 255};
+const HudColor kHudDim = {150, 150, 150, 255};
+const HudColor kHudPanel = {0, 0, 0, 160};
+const HudColor kHudGood = {90, 220, 90, 255};
+const HudColor kHudSlow = {240, 200, 60, 255};
+const HudColor kHudBad = {240, 70, 60, 255};
+
+struct HudVertex
+{
+	float x, y;
+	float u, v;
+	HudColor color;
+};
+
+struct HudState
+{
+	static const int kMaxVertices = 6 * 1024;
+	static const int kCellW = 6, kCellH = 8;          // 5x7 glyph plus padding
+	static const int kAtlasCols = 16, kAtlasRows = 5; // last row is a solid cell
+	static const int kScale = 2;
+	static const int kGraphFrames = 120;
+
+	bool enabled = false;
+	bool initialized = false;
+	GLuint program = 0, vao = 0, vbo = 0, atlas = 0;
+	GLint viewportLoc = -1, atlasLoc = -1;
+
+	HudVertex vertices[kMaxVertices];
+	int vertexCount = 0;
+
+	float frameMs[kGraphFrames] = {};
+	int frameHead = 0;
+	int frameCount = 0;     // slots of frameMs holding a sample
+	double lastFrameTime = 0.0;
+	std::atomic<bool> restart{false};   // H was pressed; the next draw starts a fresh graph
+	double buildMs = 0.0;   // CPU time of the previous HUD update
+};
+HudState gHud;
+
+void hudInit()
+{
+	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vertexShader, 1, &hudVertexShaderSrc, NULL);
+	glCompileShader(vertexShader);
+	checkShaderCompilation(vertexShader);
+
+	GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(fragmentShader, 1, &hudFragmentShaderSrc, NULL);
+	glCompileShader(fragmentShader);
+	checkShaderCompilation(fragmentShader);
+
+	gHud.program = glCreateProgram();
+	glAttachShader(gHud.program, vertexShader);
+	glAttachShader(gHud.program, fragmentShader);
+	glLinkProgram(gHud.program);
+	checkProgramLinking(gHud.program);
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+	gHud.viewportLoc = glGetUniformLocation(gHud.program, "viewport");
+	gHud.atlasLoc = glGetUniformLocation(gHud.program, "atlas");
+
+	// Bake the font into the atlas
+	const int atlasW = HudState::kAtlasCols * HudState::kCellW;
+	const int atlasH = HudState::kAtlasRows * HudState::kCellH;
+	vector<unsigned char> pixels(atlasW * atlasH, 0);
+	for (int g = 0; g < 64; ++g)
+	{
+		int cx = (g % HudState::kAtlasCols) * HudState::kCellW;
+		int cy = (g / HudState::kAtlasCols) * HudState::kCellH;
+		for (int row = 0; row < 7; ++row)
+			for (int col = 0; col < 5; ++col)
+				if (kHudFont[g][row] & (0x10 >> col))
+					pixels[(cy + row) * atlasW + cx + col] = 255;
+	}
+	int solidY = (HudState::kAtlasRows - 1) * HudState::kCellH;
+	for (int y = 0; y < HudState::kCellH; ++y)
+		for (int x = 0; x < HudState::kCellW; ++x)
+			pixels[(solidY + y) * atlasW + x] = 255;
+
+	glGenTextures(1, &gHud.atlas);
+	glBindTexture(GL_TEXTURE_2D, gHud.atlas);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, atlasW, atlasH, 0, GL_RED, GL_UNSIGNED_BYTE, pixels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glGenVertexArrays(1, &gHud.vao);
+	glGenBuffers(1, &gHud.vbo);
+	glBindVertexArray(gHud.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, gHud.vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(gHud.vertices), NULL, GL_DYNAMIC_DRAW);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (void *)offsetof(HudVertex, x));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (void *)offsetof(HudVertex, u));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(HudVertex), (void *)offsetof(HudVertex, color));
+	glEnableVertexAttribArray(2);
+	glBindVertexArray(0);
+
+	// GPU pass times are part of the overlay
+	gpuTimerInit();
+	gHud.initialized = true;
+}
+
+// Runs on the event thread, so the graph itself is cleared by the renderer
+void hudToggle()
+{
+	gHud.enabled = !gHud.enabled;
+	gHud.restart.store(true, std::memory_order_release);
+}
+
+static void hudQuad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, HudColor c)
+{
+	if (gHud.vertexCount + 6 > HudState::kMaxVertices)
+		return;
+	HudVertex *v = gHud.vertices + gHud.vertexCount;
+	v[0] = {x0, y0, u0, v0, c};
+	v[1] = {x1, y0, u1, v0, c};
+	v[2] = {x1, y1, u1, v1, c};
+	v[3] = {x0, y0, u0, v0, c};
+	v[4] = {x1, y1, u1, v1, c};
+	v[5] = {x0, y1, u0, v1, c};
+	gHud.vertexCount += 6;
+}
+
+static void hudRect(float x, float y, float w, float h, HudColor c)
+{
+	// Sample the middle of the solid cell
+	const float u = 0.5f * HudState::kCellW / (HudState::kAtlasCols * HudState::kCellW);
+	const float v = (HudState::kAtlasRows - 0.5f) / HudState::kAtlasRows;
+	hudQuad(x, y, x + w, y + h, u, v, u, v, c);
+}
+
+static void hudText(float x, float y, HudColor c, const char *fmt, ...)
+{
+	char text[128];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(text, sizeof(text), fmt, args);
+	va_end(args);
+
+	const float atlasW = HudState::kAtlasCols * HudState::kCellW;
+	const float atlasH = HudState::kAtlasRows * HudState::kCellH;
+	const float s = HudState::kScale;
+	for (const char *p = text; *p; ++p, x += HudState::kCellW * s)
+	{
+		int ch = toupper((unsigned char)*p);
+		if (ch == ' ')
+			continue;
+		if (ch < 32 || ch > 95)
+			ch = '?';
+		int g = ch - 32;
+		float u0 = (g % HudState::kAtlasCols) * HudState::kCellW / atlasW;
+		float v0 = (g / HudState::kAtlasCols) * HudState::kCellH / atlasH;
+		hudQuad(x, y, x + 5 * s, y + 7 * s, u0, v0, u0 + 5 / atlasW, v0 + 7 / atlasH, c);
+	}
+}
+
+// Builds the overlay and draws it in one call. Runs last in display().
+void hudDraw()
+{
+	if (!gHud.enabled)
+		return;
+	PROFILE_SCOPE("display.hud");
+	PERF_REGION(PERF_SUBMISSION);
+	double start = glfwGetTime();
+	if (!gHud.initialized)
+		hudInit();
+
+	// Samples from before the HUD was hidden would skew the graph and mean
+	if (gHud.restart.exchange(false, std::memory_order_acquire))
+	{
+		std::fill(gHud.frameMs, gHud.frameMs + HudState::kGraphFrames, 0.0f);
+		gHud.frameHead = gHud.frameCount = 0;
+		gHud.lastFrameTime = 0.0;
+	}
+	if (gHud.lastFrameTime > 0.0)
+	{
+		gHud.frameMs[gHud.frameHead] = (start - gHud.lastFrameTime) * 1000.0;
+		gHud.frameHead = (gHud.frameHead + 1) % HudState::kGraphFrames;
+		gHud.frameCount = std::min(gHud.frameCount + 1, HudState::kGraphFrames);
+	}
+	gHud.lastFrameTime = start;
+	gHud.vertexCount = 0;
+
+	const float s = HudState::kScale;
+	const float lineH = HudState::kCellH * s + 4;
+	const float graphH = 48;
+	const float x = 16, width = 44 * HudState::kCellW * s;
+	float y = 16;
+
+	const float latencyH = 24;
+	hudRect(x - 8, y - 8, width + 16, 9 * lineH + graphH + latencyH + 32, kHudPanel);
+
+	hudText(x, y, kHudText, "SCORE %d", gSim.view.score);
+	y += lineH;
+
+	float meanMs = 0, maxMs = 0;
+	for (int i = 0; i < HudState::kGraphFrames; ++i)
+	{
+		meanMs += gHud.frameMs[i];
+		maxMs = std::max(maxMs, gHud.frameMs[i]);
+	}
+	meanMs /= std::max(gHud.frameCount, 1);
+	hudText(x, y, kHudText, "FRAME %5.2f MS  MAX %5.2f  %4.0f FPS", meanMs, maxMs, meanMs > 0 ? 1000.0f / meanMs : 0.0f);
+	y += lineH;
+
+	// Frame-time graph, oldest on the left; full height is 33.3 ms with a
+	// marker at 16.7 ms
+	const float barW = width / HudState::kGraphFrames;
+	for (int i = 0; i < HudState::kGraphFrames; ++i)
+	{
+		float ms = gHud.frameMs[(gHud.frameHead + i) % HudState::kGraphFrames];
+		float h = std::min(ms / 33.3f, 1.0f) * graphH;
+		HudColor c = ms <= 17.0f ? kHudGood : (ms <= 34.0f ? kHudSlow : kHudBad);
+		hudRect(x + i * barW, y + graphH - h, std::max(barW - 1, 1.0f), h, c);
+	}
+	hudRect(x, y + graphH / 2, width, 1, kHudDim);
+	y += graphH + 8;
+
+	float presentMean, presentStddev;
+	pacingRollingStats(presentMean, presentStddev);
+	hudText(x, y, gPacing.lastIntervalMs > 2.0f * presentMean ? kHudSlow : kHudText, "%s %5.2f MS SD %4.2f MISS %lld STUT %lld",
+			kPacingModeNames[gPacing.mode], presentMean, presentStddev, gPacing.missedDeadlines, gPacing.stutters);
+	y += lineH;
+
+	if (gGpuTimer.enabled && gGpuTimer.historyCount > 0)
+	{
+		float passMean[GPU_PASS_COUNT], passMax, totalMean, totalMax;
+		for (int p = 0; p < GPU_PASS_COUNT; ++p)
+			gpuPassRollingStats(p, passMean[p], passMax);
+		gpuPassRollingStats(GPU_PASS_COUNT, totalMean, totalMax);
+		hudText(x, y, kHudText, "GPU %5.2f MS  MAX %5.2f  HUD %4.2f", totalMean, totalMax, passMean[GPU_PASS_HUD]);
+		y += lineH;
+		hudText(x, y, kHudDim, "BG %4.2f BUNNY %4.2f ROAD %4.2f OBST %4.2f", passMean[GPU_PASS_BACKGROUND],
+				passMean[GPU_PASS_BUNNY], passMean[GPU_PASS_ROAD], passMean[GPU_PASS_OBSTACLES]);
+	}
+	else
+	{
+		hudText(x, y, kHudDim, "GPU TIMERS UNAVAILABLE");
+		y += lineH;
+	}
+	y += lineH;
+
+	const long long *last = gRenderStats.last;
+	hudText(x, y, kHudText, "DRAWS %lld  TRIS %lld  PROGRAMS %lld", last[STAT_DRAW_CALLS], last[STAT_TRIANGLES],
+			last[STAT_PROGRAM_SWITCHES]);
+	y += lineH;
+	hudText(x, y, kHudText, "VAO %lld BUF %lld TEX %lld UNI %lld %.1fKB", last[STAT_VAO_BINDS], last[STAT_BUFFER_BINDS],
+			last[STAT_TEXTURE_BINDS], last[STAT_UNIFORM_UPLOADS], last[STAT_BYTES_UPLOADED] / 1024.0);
+	y += lineH;
+	hudText(x, y, kHudDim, "HUD CPU %.3f MS  ALLOCS %llu", gHud.buildMs, gFrameAllocs.count);
+	y += lineH;
+
+	// Input-to-present latency of the last events, one bar per bucket from
+	// <=2 ms on the left to >100 ms on the right
+	float inputMean, inputMax;
+	inputLatencyRollingStats(inputMean, inputMax);
+	hudText(x, y, kHudText, "INPUT %5.2f MS  MAX %5.2f  N %d", inputMean, inputMax, gInputLatency.windowCount);
+	y += lineH;
+	const float bucketW = width / kInputLatencyBuckets;
+	for (int b = 0; b < kInputLatencyBuckets; ++b)
+	{
+		int n = gInputLatency.histogram[b];
+		float h = gInputLatency.windowCount > 0 ? latencyH * n / gInputLatency.windowCount : 0.0f;
+		HudColor c = b < 5 ? kHudGood : (b < 8 ? kHudSlow : kHudBad);
+		hudRect(x + b * bucketW, y + latencyH - h, bucketW - 2, std::max(h, n > 0 ? 1.0f : 0.0f), c);
+	}
+	hudRect(x, y + latencyH, width, 1, kHudDim);
+
+	gpuPassBegin(GPU_PASS_HUD);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	statUseProgram(gHud.program);
+	statUniform2f(gHud.viewportLoc, (float)gWidth, (float)gHeight);
+	statUniform1i(gHud.atlasLoc, 0);
+	glActiveTexture(GL_TEXTURE0);
+	statBindTexture(GL_TEXTURE_2D, gHud.atlas);
+	statBindVertexArray(gHud.vao);
+	statBindBuffer(GL_ARRAY_BUFFER, gHud.vbo);
+	// Orphan last frame's storage so the upload never waits on the GPU
+	statBufferData(GL_ARRAY_BUFFER, sizeof(gHud.vertices), NULL, GL_DYNAMIC_DRAW);
+	statBufferSubData(GL_ARRAY_BUFFER, 0, gHud.vertexCount * sizeof(HudVertex), gHud.vertices);
+	statDrawArrays(GL_TRIANGLES, 0, gHud.vertexCount);
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	gpuPassEnd();
+	GL_CHECK("hud");
+
+	gHud.buildMs = (glfwGetTime() - start) * 1000.0;
+}
+
+void display()
+{
+	PROFILE_SCOPE("display");
+	PERF_REGION(PERF_SUBMISSION);
+	glClearColor(0, 0, 0, 1);
+	#ifdef __EMSCRIPTEN__
+	glClearDepthf(1.0f);
+	#else
+	glClearDepth(1.0f);
+	#endif
+	glClearStencil(0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+    GL_CHECK("up");
+    glDisable(GL_DEPTH_TEST);  // Disable depth test for background
+
+    // Draw background
+    if (bgShaderProgram != 0) {
+        PROFILE_SCOPE("display.background");
+        gpuPassBegin(GPU_PASS_BACKGROUND);
+        statUseProgram(bgShaderProgram);
+        GL_CHECK("Shader");
+
+        if (bgVAO != 0) {
+            statBindVertexArray(bgVAO);
+            GL_CHECK("VAO");
+        }
+
+        if (bgTexture != 0) {
+            glActiveTexture(GL_TEXTURE0);
+            statBindTexture(GL_TEXTURE_2D, bgTexture);
+            GLint bgTextureLocation = glGetUniformLocation(bgShaderProgram, "bgTexture");
+            if (bgTextureLocation >= 0) {
+                statUniform1i(bgTextureLocation, 0);
+                GL_CHECK("TextureLocation");
+            }
+        }
+
+        for (int layer = 0; layer < gBackgroundLayers; ++layer) {
+            statDrawArrays(GL_TRIANGLES, 0, 6);
+        }
+        GL_CHECK("DrawArrays");
+
+        statBindVertexArray(0);
+        GL_CHECK("BindVertex");
+        gpuPassEnd();
+    }
+
+	// Blend of the last two simulation steps
+	const RenderState &view = gSim.view;
+
+	{
+	PROFILE_SCOPE("display.bunny");
+	gpuPassBegin(GPU_PASS_BUNNY);
+    statUseProgram(gProgram[0]);
+    glEnable(GL_DEPTH_TEST);
+    statUseProgram(gProgram[activeProgramIndex]);
+    GL_CHECK("End of 3D_1");
+    statUniformMatrix4fv(projectionMatrixLoc[activeProgramIndex], projectionMatrix);
+    GL_CHECK("End of 3D_2");
+    statUniformMatrix4fv(viewingMatrixLoc[activeProgramIndex], viewingMatrix);
+    GL_CHECK("End of 3D_3");
+    statUniform3fv(eyePosLoc[activeProgramIndex], eyePos);
+    GL_CHECK("End of 3D_5");
+	// Compute the modeling matrix, with the cursor sampled as late as possible
+	RenderState bunny = view;
+	bunny.translationX = lateLatchedBunnyX(view);
+	modelingMatrix = bunnyModelingMatrix(bunny);
+	bunnyTransformUpload(modelingMatrix);
+    GL_CHECK("End of 3D_4");
+    drawModel();
+    GL_CHECK("End of 3D_6");
+    gpuPassEnd();
+	}
+
+    // Road tiles, then obstacles, from the render list. Obstacles are drawn
+    // after the whole road so each pass can be timed on its own; depth
+    // testing makes the order irrelevant on screen. Hits are tested in
+    // simulationStep().
+    sceneUpdate(view);
+    static const char *const kPassScopes[SCENE_PASS_COUNT] = {"display.road", "display.obstacles"};
+    static const GpuPass kPassTimers[SCENE_PASS_COUNT] = {GPU_PASS_ROAD, GPU_PASS_OBSTACLES};
+    for (int pass = 0; pass < SCENE_PASS_COUNT; ++pass)
+    {
+        PROFILE_SCOPE(kPassScopes[pass]);
+        gpuPassBegin(kPassTimers[pass]);
+        int material = -1;
+        for (int k = gScene.passStart[pass]; k < gScene.passStart[pass + 1]; ++k)
+        {
+            int e = gScene.renderList[k];
+            if (gScene.store.material[e] != material)
+            {
+                material = gScene.store.material[e];
+                statUseProgram(gProgram[material]);
+                statUniformMatrix4fv(projectionMatrixLoc[material], projectionMatrix);
+                statUniformMatrix4fv(viewingMatrixLoc[material], viewingMatrix);
+                statUniform3fv(eyePosLoc[material], eyePos);
+                GL_CHECK("Scene material");
+            }
+            statUniformMatrix4fv(modelingMatrixLoc[material], &gScene.models[16 * k]);
+            drawModel2();
+            GL_CHECK("Scene draw");
+        }
+        gpuPassEnd();
+    }
+    hudDraw();
+    activeProgramIndex=0;
+    statBindVertexArray(0);
+    GL_CHECK("End of display");
+
+}
+
+void reshape(GLFWwindow *window, int w, int h)
+{
+	w = w < 1 ? 1 : w;
+	h = h < 1 ? 1 : h;
+
+	gWidth = w;
+	gHeight = h;
+
+	glViewport(0, 0, w, h);
+
+	// Use perspective projection
+	float fovyRad = (float)(90.0 / 180.0) * M_PI;
+	projectionMatrix = glm::perspective(fovyRad , w / (float)h, 1.0f, 100.0f);
+
+	// Assume default camera position and orientation (camera is at
+	// (0, 0, 0) with looking at -z direction and its up vector pointing
+	// at +y direction)
+	//
+	// viewingMatrix = glm::mat4(1);
+	viewingMatrix = glm::lookAt(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0) + glm::vec3(0, 0, -1), glm::vec3(0, 1, 0));
+}
+// Window changes seen by the event thread. The thread that owns the GL
+// context applies them at the start of its next frame; sizes are packed as
+// width << 32 | height, 0 when nothing is pending.
+struct WindowEvents
+{
+	std::atomic<unsigned long long> resize{0};
+	std::atomic<unsigned long long> framebufferResize{0};
+	std::atomic<bool> hudToggle{false};
+};
+WindowEvents gWindowEvents;
+
+static unsigned long long packSize(int w, int h)
+{
+	return (unsigned long long)(unsigned)std::max(w, 1) << 32 | (unsigned)std::max(h, 1);
+}
+
+void window_size_callback(GLFWwindow *window, int w, int h)
+{
+	gWindowEvents.resize.store(packSize(w, h), std::memory_order_release);
+	powerWake();
+}
+
+void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
+	gWindowEvents.framebufferResize.store(packSize(width, height), std::memory_order_release);
+	powerWake();
+}
+
+void window_focus_callback(GLFWwindow *window, int focused)
+{
+	gPower.focused.store(focused == GLFW_TRUE, std::memory_order_relaxed);
+	powerWake();
+}
+
+void window_iconify_callback(GLFWwindow *window, int iconified)
+{
+	gPower.iconified.store(iconified == GLFW_TRUE, std::memory_order_relaxed);
+	powerWake();
+}
+
+// Exposed or damaged: the render side must draw again
+void window_refresh_callback(GLFWwindow *window)
+{
+	powerWake();
+}
+
+// An idle render side must notice the close request
+void window_close_callback(GLFWwindow *window)
+{
+	powerWake();
+}
+
+void applyWindowEvents(GLFWwindow *window)
+{
+	if (unsigned long long size = gWindowEvents.resize.exchange(0, std::memory_order_acquire))
+		reshape(window, (int)(size >> 32), (int)(size & 0xffffffffu));
+	// Adjust the viewport when the window size changes
+	if (unsigned long long size = gWindowEvents.framebufferResize.exchange(0, std::memory_order_acquire))
+		glViewport(0, 0, (int)(size >> 32), (int)(size & 0xffffffffu));
+	if (gWindowEvents.hudToggle.exchange(false, std::memory_order_acquire))
+		hudToggle();
+}
+
+// Queues a move of the bunny to fraction t of the way across the road
+void queueCursorInput(float t)
+{
+    InputEvent e = {glfwGetTime(), INPUT_CURSOR, 0, 0, cursorToBunnyX(t)};
+    gInputQueue.push(e);
+}
+
+void cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
+{
+    // The event thread's own view of the width; gWidth belongs to the renderer
+    int windowWidth, windowHeight;
+    glfwGetWindowSize(window, &windowWidth, &windowHeight);
+    if (!useMouseControls || windowWidth <= 0) return;
+    const float t = static_cast<float>(xpos) / static_cast<float>(windowWidth);
+    gLowLatency.latestCursorX.store(cursorToBunnyX(t), std::memory_order_relaxed);
+    queueCursorInput(t);
+    powerWake();
+}
+void keyboard(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+	if (key == GLFW_KEY_H && action == GLFW_PRESS)
+	{   gWindowEvents.hudToggle.store(true, std::memory_order_release);
+	}
+	else if (key == GLFW_KEY_P && action == GLFW_PRESS)
+	{   gPower.paused.store(!gPower.paused.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+	else if (key == GLFW_KEY_A || key == GLFW_KEY_D || key == GLFW_KEY_X || key == GLFW_KEY_R)
+	{   // R also ends a pause
+	    if (key == GLFW_KEY_R && action == GLFW_PRESS)
+	        gPower.paused.store(false, std::memory_order_relaxed);
+	    InputEvent e = {glfwGetTime(), INPUT_KEY, key, action, 0.0f};
+	    gInputQueue.push(e);
+	}
+	powerWake();
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark mode
+//
+// --benchmark runs the game with a seeded RNG and scripted (or no) input for a
+// fixed number of frames or seconds, then writes frame-time percentiles and
+// submission counts as JSON. Input script lines look like
+//     <frame> <A|D|X|R> <press|release>
+//     <frame> mouse <0..1>
+// and are applied right before that frame's display().
+// ---------------------------------------------------------------------------
+
+struct ScriptedInput
+{
+	int frame;
+	int key;        // GLFW key, or -1 for a mouse move
+	int action;     // GLFW_PRESS / GLFW_RELEASE
+	float mouseT;   // normalized cursor x for mouse moves
+};
+
+struct BenchmarkState
+{
+	bool enabled = false;
+	unsigned int seed = 1;
+	int frames = 1000;
+	int warmupFrames = 60;
+	double seconds = 0.0;     // 0 = run for `frames` frames
+	string inputPath;
+	string outputPath;        // empty = stdout
+
+	vector<ScriptedInput> script;
+	size_t nextScripted = 0;
+
+	int frame = 0;
+	double startTime = 0.0;
+	double startupMs = 0.0;   // glfwInit() to the first benchmarked frame
+	double frameStart = 0.0;
+	double lastFrameStart = 0.0;
+	vector<double> cpuMs;
+	vector<double> frameMs;
+	vector<double> gpuMs;
+	vector<double> gpuPassMs[GPU_PASS_COUNT];
+	vector<double> inputLatencyMs;
+	vector<double> presentMs;          // present-to-present intervals
+	long long missedDeadlines = 0;
+	long long stutters = 0;
+	long long inputLatencyHistogram[kInputLatencyBuckets] = {};
+	long long stats[STAT_COUNT] = {};   // renderer counters summed over measured frames
+	unsigned long long allocs = 0;      // C++ heap allocations over measured frames
+	unsigned long long allocBytes = 0;
+	int allocatingFrames = 0;
+};
+BenchmarkState gBenchmark;
+
+static bool loadInputScript(const string &fileName, vector<ScriptedInput> &script)
+{
+	string data;
+	if (!ReadDataFromFile(fileName, data))
+	{
+		return false;
+	}
+
+	stringstream lines(data);
+	string curLine;
+	while (getline(lines, curLine))
+	{
+		if (curLine.empty() || curLine[0] == '#')
+			continue;
+
+		stringstream str(curLine);
+		ScriptedInput in;
+		string what, arg;
+		if (!(str >> in.frame >> what >> arg))
+			continue;
+
+		in.key = -1;
+		in.action = GLFW_PRESS;
+		in.mouseT = 0.0f;
+		if (what == "mouse")
+		{
+			in.mouseT = clampf((float)atof(arg.c_str()), 0.0f, 1.0f);
+		}
+		else
+		{
+			if (what == "A" || what == "a") in.key = GLFW_KEY_A;
+			else if (what == "D" || what == "d") in.key = GLFW_KEY_D;
+			else if (what == "X" || what == "x") in.key = GLFW_KEY_X;
+			else if (what == "R" || what == "r") in.key = GLFW_KEY_R;
+			else continue;
+			in.action = (arg == "release") ? GLFW_RELEASE : GLFW_PRESS;
+		}
+		script.push_back(in);
+	}
+
+	std::stable_sort(script.begin(), script.end(),
+					 [](const ScriptedInput &a, const ScriptedInput &b) { return a.frame < b.frame; });
+	return true;
+}
+
+static void applyScriptedInput(GLFWwindow *window)
+{
+	while (gBenchmark.nextScripted < gBenchmark.script.size() &&
+		   gBenchmark.script[gBenchmark.nextScripted].frame <= gBenchmark.frame)
+	{
+		const ScriptedInput &in = gBenchmark.script[gBenchmark.nextScripted++];
+		if (in.key < 0)
+			queueCursorInput(in.mouseT);
+		else
+			keyboard(window, in.key, 0, in.action, 0);
+	}
+}
+
+// Room for a run's samples up front, so measured frames rarely grow them
+static void benchmarkReserveSamples()
+{
+	gBenchmark.cpuMs.reserve(gBenchmark.frames);
+	gBenchmark.frameMs.reserve(gBenchmark.frames);
+	gBenchmark.gpuMs.reserve(gBenchmark.frames);
+	for (int p = 0; p < GPU_PASS_COUNT; ++p)
+		gBenchmark.gpuPassMs[p].reserve(gBenchmark.frames);
+	gBenchmark.inputLatencyMs.reserve(gBenchmark.script.size());
+	gBenchmark.presentMs.reserve(gBenchmark.frames);
+}
+
+static void benchmarkInit()
+{
+	// The script drives the bunny; the real cursor must not.
+	useMouseControls = false;
+	// Every frame is measured, game over or not
+	gPower.disabled = true;
+
+	benchmarkReserveSamples();
+
+	gBenchmark.startTime = glfwGetTime();
+	gBenchmark.lastFrameStart = gBenchmark.startTime;
+	// The GLFW timer starts at glfwInit()
+	gBenchmark.startupMs = gBenchmark.startTime * 1000.0;
+}
+
+static bool benchmarkMeasuring()
+{
+	return gBenchmark.frame >= gBenchmark.warmupFrames;
+}
+
+// Benchmark bookkeeping may grow its sample vectors; that is not the game
+// allocating, so it is left out of the counts and --assert-no-alloc
+struct AllocGuardPause
+{
+	AllocGuardPause() { tAllocsPaused++; }
+	~AllocGuardPause() { tAllocsPaused--; }
+};
+
+// GPU results arrive a few frames late, tagged with whether their frame was
+// past warmup when it was issued
+void onGpuFrameTimed(bool record, const float passMs[GPU_PASS_COUNT], float totalMs)
+{
+	if (!gBenchmark.enabled || !record)
+		return;
+	AllocGuardPause pause;
+	gBenchmark.gpuMs.push_back(totalMs);
+	for (int p = 0; p < GPU_PASS_COUNT; ++p)
+		gBenchmark.gpuPassMs[p].push_back(passMs[p]);
+}
+
+void onInputPresented(double latencyMs)
+{
+	if (!gBenchmark.enabled || !benchmarkMeasuring())
+		return;
+	AllocGuardPause pause;
+	gBenchmark.inputLatencyMs.push_back(latencyMs);
+	gBenchmark.inputLatencyHistogram[inputLatencyBucket((float)latencyMs)]++;
+}
+
+static void benchmarkFramePresented(int pacingFlags)
+{
+	if (gPacing.presents == 0)
+		return;
+	AllocGuardPause pause;
+	gBenchmark.presentMs.push_back(gPacing.lastIntervalMs);
+	gBenchmark.missedDeadlines += (pacingFlags & PACING_MISSED) != 0;
+	gBenchmark.stutters += (pacingFlags & PACING_STUTTER) != 0;
+}
+
+static void benchmarkFrameBegin(GLFWwindow *window)
+{
+	applyScriptedInput(window);
+
+	gBenchmark.frameStart = glfwGetTime();
+}
+
+static void benchmarkFrameSubmitted()
+{
+	if (benchmarkMeasuring())
+	{
+		AllocGuardPause pause;
+		gBenchmark.cpuMs.push_back((glfwGetTime() - gBenchmark.frameStart) * 1000.0);
+		for (int k = 0; k < STAT_COUNT; ++k)
+			gBenchmark.stats[k] += gRenderStats.frame[k];
+	}
+}
+
+static void allocFrameEnd(const AllocCounters &start, bool measuring)
+{
+	gFrameAllocs.count = tAllocs.count - start.count;
+	gFrameAllocs.bytes = tAllocs.bytes - start.bytes;
+	if (!measuring)
+		return;
+	gBenchmark.allocs += gFrameAllocs.count;
+	gBenchmark.allocBytes += gFrameAllocs.bytes;
+	if (gFrameAllocs.count > 0)
+	{
+		gBenchmark.allocatingFrames++;
+		if (gAllocGuard.failOnAlloc && gAllocGuard.violations++ == 0)
+			fprintf(stderr, "Frame %d allocated %llu times (%llu bytes)\n", gBenchmark.frame,
+					gFrameAllocs.count, gFrameAllocs.bytes);
+	}
+}
+
+// Returns true once the requested frame count or duration has been reached
+static bool benchmarkFrameEnd()
+{
+	if (benchmarkMeasuring() && gBenchmark.frame > 0)
+		gBenchmark.frameMs.push_back((gBenchmark.frameStart - gBenchmark.lastFrameStart) * 1000.0);
+	gBenchmark.lastFrameStart = gBenchmark.frameStart;
+	gBenchmark.frame++;
+
+	if (gBenchmark.seconds > 0.0)
+		return glfwGetTime() - gBenchmark.startTime >= gBenchmark.seconds &&
+			   gBenchmark.frame > gBenchmark.warmupFrames;
+	return gBenchmark.frame >= gBenchmark.warmupFrames + gBenchmark.frames;
+}
+
+static long long currentRssBytes()
+{
+	#ifdef __linux__
+	long pages = 0, residentPages = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (f)
+	{
+		if (fscanf(f, "%ld %ld", &pages, &residentPages) != 2)
+			residentPages = 0;
+		fclose(f);
+	}
+	return (long long)residentPages * sysconf(_SC_PAGESIZE);
+	#else
+	return 0;
+	#endif
+}
 
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+static long long peakRssBytes()
+{
+	#ifdef __linux__
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (long long)usage.ru_maxrss * 1024;
+	#else
+	return 0;
+	#endif
+}
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(gVertexDataSizeInBytes));
+struct TimeSummary
+{
+	double mean, stddev, p50, p95, p99, max;
+};
 
-    glDrawElements(GL_TRIANGLES, gFaces.size() * 3, GL_UNSIGNED_INT, 0);
-    glGetError();
+static TimeSummary summarizeTimes(vector<double> samples)
+{
+	TimeSummary s = {0, 0, 0, 0, 0, 0};
+	if (samples.empty())
+		return s;
+
+	std::sort(samples.begin(), samples.end());
+	double sum = 0;
+	for (double v : samples)
+		sum += v;
+
+	// Nearest-rank percentiles
+	auto rank = [&](double p) {
+		size_t i = (size_t)ceil(p * samples.size());
+		return samples[i == 0 ? 0 : std::min(i - 1, samples.size() - 1)];
+	};
+	s.mean = sum / samples.size();
+	double squares = 0;
+	for (double v : samples)
+		squares += (v - s.mean) * (v - s.mean);
+	s.stddev = samples.size() > 1 ? sqrt(squares / (samples.size() - 1)) : 0.0;
+	s.p50 = rank(0.50);
+	s.p95 = rank(0.95);
+	s.p99 = rank(0.99);
+	s.max = samples.back();
+	return s;
 }
 
-void drawModel2() {
+static void writeTimeSummary(FILE *out, const char *indent, const char *name, const vector<double> &samples, bool last)
+{
+	if (samples.empty())
+	{
+		fprintf(out, "%s\"%s\": null%s\n", indent, name, last ? "" : ",");
+		return;
+	}
+	TimeSummary s = summarizeTimes(samples);
+	fprintf(out, "%s\"%s\": {\"samples\": %zu, \"mean\": %.4f, \"stddev\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}%s\n",
+			indent, name, samples.size(), s.mean, s.stddev, s.p50, s.p95, s.p99, s.max, last ? "" : ",");
+}
 
-    glBindVertexArray(gVertexAttribBuffer2);
-    glBindBuffer(GL_ARRAY_BUFFER, gVertexAttribBuffer2);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gIndexBuffer2);
+static void benchmarkReport()
+{
+	gpuTimerFlush();
 
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+	FILE *out = stdout;
+	if (!gBenchmark.outputPath.empty())
+	{
+		out = fopen(gBenchmark.outputPath.c_str(), "w");
+		if (!out)
+		{
+			fprintf(stderr, "Cannot open benchmark output: %s\n", gBenchmark.outputPath.c_str());
+			out = stdout;
+		}
+	}
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(gVertexDataSizeInBytes2));
+	int measured = gBenchmark.frame - gBenchmark.warmupFrames;
+	if (measured < 1)
+		measured = 1;
 
-    glDrawElements(GL_TRIANGLES, gFaces2.size() * 3, GL_UNSIGNED_INT, 0);
-    glGetError();
+	fprintf(out, "{\n");
+	fprintf(out, "  \"benchmark\": \"bunny-run\",\n");
+	fprintf(out, "  \"renderer\": \"%s\",\n", (const char *)glGetString(GL_RENDERER));
+	fprintf(out, "  \"seed\": %u,\n", gBenchmark.seed);
+	fprintf(out, "  \"input_script\": \"%s\",\n", gBenchmark.inputPath.c_str());
+	if (gReplay.playing)
+	{
+		fprintf(out, "  \"replay\": {\"path\": \"%s\", \"ticks\": %lld, \"hashes_checked\": %d, \"diverged_at_tick\": ",
+				gReplay.path.c_str(), gReplay.ticks, gReplay.checked);
+		if (gReplay.divergedAt >= 0)
+			fprintf(out, "%lld},\n", gReplay.divergedAt);
+		else
+			fprintf(out, "null},\n");
+	}
+	else
+		fprintf(out, "  \"replay\": null,\n");
+	fprintf(out, "  \"width\": %d,\n", gWidth);
+	fprintf(out, "  \"height\": %d,\n", gHeight);
+	fprintf(out, "  \"warmup_frames\": %d,\n", gBenchmark.warmupFrames);
+	fprintf(out, "  \"frames\": %d,\n", measured);
+	fprintf(out, "  \"duration_s\": %.4f,\n", glfwGetTime() - gBenchmark.startTime);
+	fprintf(out, "  \"startup_ms\": %.4f,\n", gBenchmark.startupMs);
+	fprintf(out, "  \"rss_bytes\": %lld,\n", currentRssBytes());
+	fprintf(out, "  \"peak_rss_bytes\": %lld,\n", peakRssBytes());
+	writeTimeSummary(out, "  ", "cpu_ms", gBenchmark.cpuMs, false);
+	writeTimeSummary(out, "  ", "frame_ms", gBenchmark.frameMs, false);
+	writeTimeSummary(out, "  ", "gpu_ms", gBenchmark.gpuMs, false);
+	writeTimeSummary(out, "  ", "present_ms", gBenchmark.presentMs, false);
+	fprintf(out, "  \"pacing\": {\"mode\": \"%s\", \"target_ms\": %.4f, \"missed_deadlines\": %lld, \"stutters\": %lld},\n",
+			kPacingModeNames[gPacing.mode], gPacing.targetPeriod * 1000.0, gBenchmark.missedDeadlines, gBenchmark.stutters);
+	writeTimeSummary(out, "  ", "input_latency_ms", gBenchmark.inputLatencyMs, false);
+	fprintf(out, "  \"input_latency_histogram\": [");
+	for (int b = 0; b < kInputLatencyBuckets; ++b)
+	{
+		fprintf(out, "%s{\"le_ms\": ", b ? ", " : "");
+		if (b + 1 < kInputLatencyBuckets)
+			fprintf(out, "%g", kInputLatencyBucketMs[b]);
+		else
+			fprintf(out, "null");
+		fprintf(out, ", \"count\": %lld}", gBenchmark.inputLatencyHistogram[b]);
+	}
+	fprintf(out, "],\n");
+	fprintf(out, "  \"input_events_dropped\": %u,\n", gInputQueue.dropped.load() + gAppliedInput.dropped.load());
+	fprintf(out, "  \"gpu_pass_ms\": {\n");
+	for (int p = 0; p < GPU_PASS_COUNT; ++p)
+		writeTimeSummary(out, "    ", kGpuPassNames[p], gBenchmark.gpuPassMs[p], p + 1 == GPU_PASS_COUNT);
+	fprintf(out, "  },\n");
+	if (gPerf.requested)
+		writePerfCounters(out, "  ", gPerf.total, gPerf.frames);
+	fprintf(out, "  \"draw_calls_per_frame\": %.2f,\n", (double)gBenchmark.stats[STAT_DRAW_CALLS] / measured);
+	fprintf(out, "  \"triangles_per_frame\": %.2f,\n", (double)gBenchmark.stats[STAT_TRIANGLES] / measured);
+	fprintf(out, "  \"render_stats_per_frame\": {\n");
+	for (int k = 0; k < STAT_COUNT; ++k)
+		fprintf(out, "    \"%s\": %.2f%s\n", kRenderStatNames[k], (double)gBenchmark.stats[k] / measured,
+				k + 1 < STAT_COUNT ? "," : "");
+	fprintf(out, "  },\n");
+	fprintf(out, "  \"allocations_per_frame\": %.2f,\n", (double)gBenchmark.allocs / measured);
+	fprintf(out, "  \"allocated_bytes_per_frame\": %.2f,\n", (double)gBenchmark.allocBytes / measured);
+	fprintf(out, "  \"allocating_frames\": %d,\n", gBenchmark.allocatingFrames);
+	fprintf(out, "  \"final_score\": %d,\n", score);
+	fprintf(out, "  \"game_over\": %s\n", gamefinish != 0 ? "true" : "false");
+	fprintf(out, "}\n");
+
+	if (out != stdout)
+		fclose(out);
 }
 
-
-void display()
+// ---------------------------------------------------------------------------
+// Stress mode
+//
+// --stress runs the benchmark once per sweep step, changing one scene
+// parameter at a time, and reports frame time and memory per step. Each
+// parameter loads one pipeline stage:
+//     lanes, tiles, obstacle-stride  -> CPU submission (draw calls)
+//     copies, subdivide              -> vertex processing (triangles)
+//     overdraw                       -> fill (full-screen layers)
+// The first step of each sweep whose p95 frame time exceeds the budget is
+// reported as that stage's limit.
+// ---------------------------------------------------------------------------
+
+struct SceneParams
 {
-	glClearColor(0, 0, 0, 1);
-	#ifdef __EMSCRIPTEN__
-	glClearDepthf(1.0f);
-	#else
-	glClearDepth(1.0f);
-	#endif
-	glClearStencil(0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	int lanes, tiles, obstacleStride, copies, subdivisions, overdraw;
+};
 
-    string here="up";
-    checkGLError(here);
-    glDisable(GL_DEPTH_TEST);  // Disable depth test for background
+struct StressStep
+{
+	string axis;
+	int value;
+	SceneParams params;
+};
 
-    // Draw background
-    if (bgShaderProgram != 0) {
-        glUseProgram(bgShaderProgram);
-        here="Shader";
-        checkGLError(here);
+struct StressStepResult
+{
+	StressStep step;
+	double drawCalls, triangles;
+	vector<double> cpuMs, frameMs, gpuMs;
+	long long rssBytes, peakRssBytes, meshBytes;
+	unsigned long long perfTotal[PERF_REGION_COUNT][PERF_COUNTER_COUNT];   // --perf-counters
+	long long perfFrames;
+};
 
-        if (bgVAO != 0) {
-            glBindVertexArray(bgVAO);
-            here="VAO";
-            checkGLError(here);
-        }
+struct StressState
+{
+	bool enabled = false;
+	double budgetMs = 1000.0 / 60.0;
+	vector<string> sweeps;            // "<axis>=v1,v2,..." as given on the command line
+	vector<StressStep> steps;
+	vector<StressStepResult> results;
+	size_t current = 0;
+};
+StressState gStress;
 
-        if (bgTexture != 0) {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, bgTexture);
-            GLint bgTextureLocation = glGetUniformLocation(bgShaderProgram, "bgTexture");
-            if (bgTextureLocation >= 0) {
-                glUniform1i(bgTextureLocation, 0);
-                here="TextureLocation";
-                checkGLError(here);
-            }
-        }
+static SceneParams currentSceneParams()
+{
+	SceneParams p = {gLaneCount, gTileCount, gObstacleRowStride, gBunnyCopies, gBunnySubdivisions, gBackgroundLayers};
+	return p;
+}
 
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        here="DrawArrays";
-        checkGLError(here);
+static const char *stressStage(const string &axis)
+{
+	if (axis == "copies" || axis == "subdivide")
+		return "vertex";
+	if (axis == "overdraw")
+		return "fill";
+	return "submission";
+}
 
-        glBindVertexArray(0);
-        here="BindVertex";
-        checkGLError(here);
-    }
+static int *sceneParamField(SceneParams &p, const string &axis)
+{
+	if (axis == "lanes") return &p.lanes;
+	if (axis == "tiles") return &p.tiles;
+	if (axis == "obstacle-stride") return &p.obstacleStride;
+	if (axis == "copies") return &p.copies;
+	if (axis == "subdivide") return &p.subdivisions;
+	if (axis == "overdraw") return &p.overdraw;
+	return NULL;
+}
 
-	static float angle = 0;
-	float angleRad = (float)(angle / 180.0) * M_PI;
+static void buildStressSteps()
+{
+	if (gStress.sweeps.empty())
+	{
+		gStress.sweeps.push_back("lanes=4,8,16,32,64,128,256");
+		gStress.sweeps.push_back("subdivide=0,1,2,3,4,5");
+		gStress.sweeps.push_back("overdraw=1,2,4,8,16,32,64");
+	}
 
-	// Compute the modeling matrix
-	glm::mat4 matT = glm::translate(glm::mat4(1.0), glm::vec3(translationX+1, jumpHeight+4.5, -3));   //(x,y,z)
-	glm::mat4 matS = glm::scale(glm::mat4(1.0), glm::vec3(0.4, 0.4, 0.4));
-    glm::mat4 matT2 = glm::translate(glm::mat4(1.0), glm::vec3(translationX, 10, -10.f));
-    glm::mat4 matR = glm::rotate<float>(glm::mat4(1.0), (rotateX / 180.) * M_PI, glm::vec3(0.0, 1.0, 0.0));
-    glm::mat4 matZ = glm::rotate<float>(glm::mat4(1.0), (rotateZ / 180.) * M_PI, glm::vec3(1.0, 0.0, 0.0));
-	modelingMatrix = matT *matS* matR*matZ;
-    glUseProgram(gProgram[0]);
-    glEnable(GL_DEPTH_TEST);
-    glUseProgram(gProgram[activeProgramIndex]);
-    checkGLError("End of 3D_1");
-    glUniformMatrix4fv(projectionMatrixLoc[activeProgramIndex], 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-    checkGLError("End of 3D_2");
-    glUniformMatrix4fv(viewingMatrixLoc[activeProgramIndex], 1, GL_FALSE, glm::value_ptr(viewingMatrix));
-    checkGLError("End of 3D_3");
-    glUniformMatrix4fv(modelingMatrixLoc[activeProgramIndex], 1, GL_FALSE, glm::value_ptr(modelingMatrix));
-    checkGLError("End of 3D_4");
-    glUniform3fv(eyePosLoc[activeProgramIndex], 1, glm::value_ptr(eyePos));
-    checkGLError("End of 3D_5");
-    drawModel();
-    checkGLError("End of 3D_6");
-    activeProgramIndex=2;
+	SceneParams baseline = currentSceneParams();
+	for (size_t s = 0; s < gStress.sweeps.size(); ++s)
+	{
+		const string &sweep = gStress.sweeps[s];
+		size_t eq = sweep.find('=');
+		string axis = sweep.substr(0, eq);
+		SceneParams probe = baseline;
+		if (eq == string::npos || !sceneParamField(probe, axis))
+		{
+			fprintf(stderr, "Bad --sweep \"%s\"; expected <lanes|tiles|obstacle-stride|copies|subdivide|overdraw>=v1,v2,...\n", sweep.c_str());
+			exit(-1);
+		}
 
+		stringstream values(sweep.substr(eq + 1));
+		string value;
+		while (getline(values, value, ','))
+		{
+			StressStep step;
+			step.axis = axis;
+			step.value = atoi(value.c_str());
+			step.params = baseline;
+			*sceneParamField(step.params, axis) = step.value;
+			gStress.steps.push_back(step);
+		}
+	}
+}
 
-    for(int i=0;i<4;i++){
-        if(activeProgramIndex>=2)
-            {
-                activeProgramIndex=1;
-            }
-            else if(activeProgramIndex==1)
-            {
-                activeProgramIndex=2;
-            }
+static void applySceneParams(const SceneParams &p)
+{
+	bool meshChanged = p.copies != gBunnyCopies || p.subdivisions != gBunnySubdivisions;
 
-        for(int j=-1;j<30;j++){
-            if(j!=-1){
-                glUseProgram(gProgram[activeProgramIndex]);
-                matT2 = glm::translate(glm::mat4(1.0), glm::vec3(-3 + i * 2, -3, -60 + fmod( 2 * j + roadVelocity, 60.0f) ));
-
-                modelingMatrix2= matT2 ;
-                checkGLError("End of 3D_1");
-                glUniformMatrix4fv(projectionMatrixLoc[activeProgramIndex], 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-                checkGLError("End of 3D_2");
-                glUniformMatrix4fv(viewingMatrixLoc[activeProgramIndex], 1, GL_FALSE, glm::value_ptr(viewingMatrix));
-                checkGLError("End of 3D_3");
-                glUniformMatrix4fv(modelingMatrixLoc[activeProgramIndex], 1, GL_FALSE, glm::value_ptr(modelingMatrix2));
-                checkGLError("End of 3D_4");
-                glUniform3fv(eyePosLoc[activeProgramIndex], 1, glm::value_ptr(eyePos));
-                checkGLError("End of 3D_5");
-                drawModel2();
-                checkGLError("End of 3D_6");
-
-                if(i<3 && (j==15)){
-
-
-                    if(obstacleIndex==i){
-                        glUseProgram(gProgram[4]);
-                        matT2 = glm::translate(glm::mat4(1.0), glm::vec3(-3 + i * 3, -1.5, -60 + fmod( 2 * j + roadVelocity, 60.0f) ));
-                        glm::mat4 matS = glm::scale(glm::mat4(1.0), glm::vec3(0.4, 1.10, 0.5));
-                        modelingMatrix2= matT2 *matS;
-                        checkGLError("End of 3D_1");
-                        glUniformMatrix4fv(projectionMatrixLoc[4], 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-                        checkGLError("End of 3D_2");
-                        glUniformMatrix4fv(viewingMatrixLoc[4], 1, GL_FALSE, glm::value_ptr(viewingMatrix));
-                        checkGLError("End of 3D_3");
-                        glUniformMatrix4fv(modelingMatrixLoc[4], 1, GL_FALSE, glm::value_ptr(modelingMatrix2));
-                        checkGLError("End of 3D_4");
-                        glUniform3fv(eyePosLoc[4], 1, glm::value_ptr(eyePos));
-                        checkGLError("End of 3D_5");
-                        drawModel2();
-                        checkGLError("End of 3D_6");
-
-                        float z1 = modelingMatrix[3][2];
-                        float z2 = modelingMatrix2[3][2];
-                        float y1 = modelingMatrix[3][0];
-                        float y2 = modelingMatrix2[3][0];
-                        if (z2 - 1 <= z1 && z1 <= z2 + 1 && y2 - 1 <= y1 && y1 <= y2 + 1) {
-                            isLoop = true;
-                            score+=200;
-                        }
-                    }
-                    else{glUseProgram(gProgram[3]);
-                        if(gamefinish==0 || variable!=i){
-                            matT2 = glm::translate(glm::mat4(1.0), glm::vec3(-3 + i * 3, -1.5, -60 + fmod( 2 * j + roadVelocity, 60.0f) ));
-                            glm::mat4 matS = glm::scale(glm::mat4(1.0), glm::vec3(0.4, 1.10, 0.5));
-                            modelingMatrix2= matT2 *matS;
-                            checkGLError("End of 3D_1");
-                            glUniformMatrix4fv(projectionMatrixLoc[3], 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-                            checkGLError("End of 3D_2");
-                            glUniformMatrix4fv(viewingMatrixLoc[3], 1, GL_FALSE, glm::value_ptr(viewingMatrix));
-                            checkGLError("End of 3D_3");
-                            glUniformMatrix4fv(modelingMatrixLoc[3], 1, GL_FALSE, glm::value_ptr(modelingMatrix2));
-                            checkGLError("End of 3D_4");
-                            glUniform3fv(eyePosLoc[3], 1, glm::value_ptr(eyePos));
-                            checkGLError("End of 3D_5");
-                            drawModel2();
-                            checkGLError("End of 3D_6");
-
-
-                        }
-                        float z1 = modelingMatrix[3][2];
-                        float z2 = modelingMatrix2[3][2];
-                        float y1 = modelingMatrix[3][0];
-                        float y2 = modelingMatrix2[3][0];
-                        if (z2 - 0.5 <= z1 && z1 <= z2 + 0.5 && y2 - 0.5 <= y1 && y1 <= y2 + 0.5) {
-                            gamefinish+=1;
-                            if(gamefinish==1){
-                                variable=i;
-                            }
-                        }}
-                }
-                if(activeProgramIndex>=2)
-                {
-                    activeProgramIndex=1;
-                }
-                else if(activeProgramIndex==1)
-                {
-                    activeProgramIndex=2;
-                }
+	gLaneCount = std::max(2, p.lanes);
+	gTileCount = std::max(1, p.tiles);
+	gObstacleRowStride = std::max(0, p.obstacleStride);
+	gBunnyCopies = std::max(1, p.copies);
+	gBunnySubdivisions = std::max(0, p.subdivisions);
+	gBackgroundLayers = std::max(1, p.overdraw);
 
+	if (meshChanged)
+		rebuildBunnyMesh();
+}
 
+// Every step plays the same game from the same start, so no step measures
+// another's game-over scene or inherits its road speed
+static void stressResetGame()
+{
+	resetGame();
+	obstacleStreamSeed(gBenchmark.seed);   // the layout of the first game again
+	gSim.snap = true;
+}
 
-            }
-            else{
-                if(-60 + fmod( -2 + roadVelocity, 60.0f)<-31.0 && -60 + fmod( -2 + roadVelocity, 60.0f)>-32){obstacleIndex = rand() % 3;}
-            }
-        }
-    }
-    if(gamefinish==0){
-        score++;
-        roadVelocity+=(score/2500+1)*0.00009f*1000 ;
-        jumpVelocity -= 0.00003f;
-        if(jumpHeight <= -6.2f)
-        up_down=true;
-        else if(jumpHeight > -5.6f)
-            up_down=false;
+static void stressBegin()
+{
+	buildStressSteps();
+	gStress.current = 0;
+	applySceneParams(gStress.steps[0].params);
+	stressResetGame();
+}
 
-        if (isAPressed) {
-            // Translate left
-            translationX -= speed; // speed is a constant or variable determining movement speed
-        }
-        if (isDPressed) {
-            // Translate right
-            translationX += speed ;
-        }
-        if(up_down==true) //Eðer yukarý dooðru çýkýyorsa.
-            jumpHeight -= jumpVelocity;
-        else if(up_down==false) //Eðer aþaðý iniyorsa.
-            jumpHeight += jumpVelocity;
-        translationX = std::max(leftBound, std::min(translationX, rightBound));
-        angle += 0.9;
+// Stores the finished step and moves to the next one. Returns false after
+// the last step.
+static bool stressNextStep()
+{
+	gpuTimerFlush();
+
+	int measured = std::max(1, gBenchmark.frame - gBenchmark.warmupFrames);
+	StressStepResult r;
+	r.step = gStress.steps[gStress.current];
+	r.drawCalls = (double)gBenchmark.stats[STAT_DRAW_CALLS] / measured;
+	r.triangles = (double)gBenchmark.stats[STAT_TRIANGLES] / measured;
+	r.cpuMs.swap(gBenchmark.cpuMs);
+	r.frameMs.swap(gBenchmark.frameMs);
+	r.gpuMs.swap(gBenchmark.gpuMs);
+	for (int p = 0; p < GPU_PASS_COUNT; ++p)
+		gBenchmark.gpuPassMs[p].clear();
+	r.rssBytes = currentRssBytes();
+	r.peakRssBytes = peakRssBytes();
+	r.meshBytes = gVertexDataSizeInBytes + gNormalDataSizeInBytes + (long long)gFaces.size() * 3 * sizeof(GLuint);
+	memcpy(r.perfTotal, gPerf.total, sizeof(r.perfTotal));
+	r.perfFrames = gPerf.frames;
+	gStress.results.push_back(r);
+
+	TimeSummary frame = summarizeTimes(r.frameMs);
+	fprintf(stderr, "stress %-16s %6d: %8.0f draws %11.0f tris  frame p50 %7.3f p95 %7.3f ms  rss %6.1f MB\n",
+			r.step.axis.c_str(), r.step.value, r.drawCalls, r.triangles, frame.p50, frame.p95, r.rssBytes / 1048576.0);
+
+	if (++gStress.current >= gStress.steps.size())
+		return false;
 
-        if(isxPressed)
-        {
-            isLoop=true;
-        }
-        if(isLoop)
-        {
-            rotateX +=rotate_velocity;
+	applySceneParams(gStress.steps[gStress.current].params);
+	stressResetGame();
+	benchmarkReserveSamples();   // the swaps above took the reserved vectors
+	gBenchmark.frame = 0;
+	memset(gBenchmark.stats, 0, sizeof(gBenchmark.stats));
+	perfCountersReset();
+	gBenchmark.startTime = glfwGetTime();
+	gBenchmark.lastFrameStart = gBenchmark.startTime;
+	return true;
+}
 
-        }
-        if(rotateX>270)
-        {
-            rotateX=-90;
-            isLoop=false;
+static void stressReport()
+{
+	FILE *out = stdout;
+	if (!gBenchmark.outputPath.empty() && !(out = fopen(gBenchmark.outputPath.c_str(), "w")))
+	{
+		fprintf(stderr, "Cannot open benchmark output: %s\n", gBenchmark.outputPath.c_str());
+		out = stdout;
+	}
 
-        }
-    }
-    else
-    {
-        jumpHeight=-6.2f;
-        rotateZ =-90;
-    }
+	fprintf(out, "{\n");
+	fprintf(out, "  \"benchmark\": \"bunny-run-stress\",\n");
+	fprintf(out, "  \"renderer\": \"%s\",\n", (const char *)glGetString(GL_RENDERER));
+	fprintf(out, "  \"seed\": %u,\n", gBenchmark.seed);
+	fprintf(out, "  \"frames_per_step\": %d,\n", gBenchmark.frames);
+	fprintf(out, "  \"budget_ms\": %.4f,\n", gStress.budgetMs);
+	fprintf(out, "  \"steps\": [\n");
+	for (size_t k = 0; k < gStress.results.size(); ++k)
+	{
+		const StressStepResult &r = gStress.results[k];
+		const SceneParams &p = r.step.params;
+		fprintf(out, "    {\n");
+		fprintf(out, "      \"axis\": \"%s\", \"stage\": \"%s\", \"value\": %d,\n", r.step.axis.c_str(), stressStage(r.step.axis), r.step.value);
+		fprintf(out, "      \"lanes\": %d, \"tiles\": %d, \"obstacle_stride\": %d, \"copies\": %d, \"subdivide\": %d, \"overdraw\": %d,\n",
+				p.lanes, p.tiles, p.obstacleStride, p.copies, p.subdivisions, p.overdraw);
+		fprintf(out, "      \"draw_calls_per_frame\": %.2f, \"triangles_per_frame\": %.2f,\n", r.drawCalls, r.triangles);
+		fprintf(out, "      \"rss_bytes\": %lld, \"peak_rss_bytes\": %lld, \"mesh_bytes\": %lld,\n", r.rssBytes, r.peakRssBytes, r.meshBytes);
+		if (gPerf.requested)
+			writePerfCounters(out, "      ", r.perfTotal, r.perfFrames);
+		writeTimeSummary(out, "      ", "cpu_ms", r.cpuMs, false);
+		writeTimeSummary(out, "      ", "frame_ms", r.frameMs, false);
+		writeTimeSummary(out, "      ", "gpu_ms", r.gpuMs, true);
+		fprintf(out, "    }%s\n", k + 1 < gStress.results.size() ? "," : "");
+	}
+	fprintf(out, "  ],\n");
+
+	// First step of each sweep that misses the budget, and which side of the
+	// pipeline was slower there.
+	fprintf(out, "  \"limits\": [\n");
+	size_t k = 0;
+	bool firstLimit = true;
+	while (k < gStress.results.size())
+	{
+		const string &axis = gStress.results[k].step.axis;
+		const StressStepResult *breaking = NULL;
+		for (; k < gStress.results.size() && gStress.results[k].step.axis == axis; ++k)
+		{
+			if (!breaking && summarizeTimes(gStress.results[k].frameMs).p95 > gStress.budgetMs)
+				breaking = &gStress.results[k];
+		}
 
-    if (gDebugLogs) std::cerr << score << std::endl;
-    activeProgramIndex=0;
-    glBindVertexArray(0);
-    checkGLError("End of display");
+		fprintf(out, "%s    {\"axis\": \"%s\", \"stage\": \"%s\", ", firstLimit ? "" : ",\n", axis.c_str(), stressStage(axis));
+		if (breaking)
+		{
+			double cpu = summarizeTimes(breaking->cpuMs).p95;
+			double gpu = summarizeTimes(breaking->gpuMs).p95;
+			fprintf(out, "\"breaks_at\": %d, \"bound\": \"%s\"}", breaking->step.value,
+					breaking->gpuMs.empty() ? "unknown" : (gpu > cpu ? "gpu" : "cpu"));
+		}
+		else
+		{
+			fprintf(out, "\"breaks_at\": null, \"bound\": null}");
+		}
+		firstLimit = false;
+	}
+	fprintf(out, "\n  ]\n");
+	fprintf(out, "}\n");
 
+	if (out != stdout)
+		fclose(out);
 }
 
-void reshape(GLFWwindow *window, int w, int h)
+// ---------------------------------------------------------------------------
+// Render thread
+//
+// Natively the main thread only waits for and dispatches GLFW events while a
+// render thread owns the GL context and runs the frames, so a swap blocked on
+// vsync no longer holds up input. Input goes to the simulation through
+// gInputQueue and window changes through gWindowEvents. Benchmarks,
+// --no-render-thread and the web build (emscripten_set_main_loop_arg) keep
+// rendering and polling in series on the main thread.
+// ---------------------------------------------------------------------------
+
+struct RenderThreadState
 {
-	w = w < 1 ? 1 : w;
-	h = h < 1 ? 1 : h;
-
-	gWidth = w;
-	gHeight = h;
+	bool disabled = false;   // --no-render-thread
+	bool active = false;
+	std::thread thread;
+	std::atomic<bool> running{false};
+};
+RenderThreadState gRenderThread;
 
-	glViewport(0, 0, w, h);
+static void parseArgs(int argc, char **argv)
+{
+	bool framesSet = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--benchmark")
+			gBenchmark.enabled = true;
+		else if (arg == "--seed" && hasValue)
+			gBenchmark.seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+		else if (arg == "--frames" && hasValue)
+		{
+			gBenchmark.frames = std::max(1, atoi(argv[++i]));
+			framesSet = true;
+		}
+		else if (arg == "--seconds" && hasValue)
+			gBenchmark.seconds = atof(argv[++i]);
+		else if (arg == "--warmup" && hasValue)
+			gBenchmark.warmupFrames = std::max(0, atoi(argv[++i]));
+		else if (arg == "--input" && hasValue)
+			gBenchmark.inputPath = argv[++i];
+		else if (arg == "--out" && hasValue)
+			gBenchmark.outputPath = argv[++i];
+		else if (arg == "--record" && hasValue)
+			gReplay.recordPath = argv[++i];
+		else if (arg == "--replay" && hasValue)
+			gReplay.path = argv[++i];
+		else if (arg == "--fast-forward" && hasValue)
+		{
+			++i;
+			gReplay.fastForward = strcmp(argv[i], "end") == 0 ? -1 : std::max(0LL, atoll(argv[i]));
+		}
+		else if (arg == "--stress")
+			gStress.enabled = gBenchmark.enabled = true;
+		else if (arg == "--sweep" && hasValue)
+			gStress.sweeps.push_back(argv[++i]);
+		else if (arg == "--budget-ms" && hasValue)
+			gStress.budgetMs = atof(argv[++i]);
+		else if (arg == "--lanes" && hasValue)
+			gLaneCount = std::max(2, atoi(argv[++i]));
+		else if (arg == "--tiles" && hasValue)
+			gTileCount = std::max(1, atoi(argv[++i]));
+		else if (arg == "--obstacle-stride" && hasValue)
+			gObstacleRowStride = std::max(0, atoi(argv[++i]));
+		else if (arg == "--copies" && hasValue)
+			gBunnyCopies = std::max(1, atoi(argv[++i]));
+		else if (arg == "--subdivide" && hasValue)
+			gBunnySubdivisions = std::max(0, atoi(argv[++i]));
+		else if (arg == "--overdraw" && hasValue)
+			gBackgroundLayers = std::max(1, atoi(argv[++i]));
+		else if (arg == "--precise-collision")
+			gPreciseCollision = true;
+		else if (arg == "--road-speed" && hasValue)
+			gRoadSpeedScale = std::max(0.0, atof(argv[++i]));
+		else if (arg == "--gpu-timers")
+			gGpuTimer.requested = true;
+		else if (arg == "--gpu-csv" && hasValue)
+		{
+			gGpuTimer.csvPath = argv[++i];
+			gGpuTimer.requested = true;
+		}
+		else if (arg == "--trace" && hasValue)
+		{
+			gTracePath = argv[++i];
+			gProfilerEnabled = true;
+		}
+		else if (arg == "--gl-debug" || arg == "--gl-debug-sync")
+		{
+			gGLDebug.requested = true;
+			gGLDebug.sync = arg == "--gl-debug-sync";
+		}
+		else if (arg == "--gl-debug-severity" && hasValue)
+		{
+			if (!parseGLDebugSeverity(argv[++i], gGLDebug.minSeverity))
+				fprintf(stderr, "Unknown severity %s; use high, medium, low or notification\n", argv[i]);
+		}
+		else if (arg == "--no-sim-thread")
+			gSim.threadDisabled = true;
+		else if (arg == "--no-render-thread")
+			gRenderThread.disabled = true;
+		else if (arg == "--no-idle")
+			gPower.disabled = true;
+		else if (arg == "--low-latency")
+			gLowLatency.lateLatch = true;
+		else if (arg == "--pacing" && hasValue)
+		{
+			if (!parsePacingMode(argv[++i], gPacing.mode))
+				fprintf(stderr, "Unknown pacing %s; use vsync, adaptive, uncapped or capped\n", argv[i]);
+		}
+		else if (arg == "--swap-interval" && hasValue)
+			gPacing.swapInterval = std::max(1, atoi(argv[++i]));
+		else if (arg == "--fps-cap" && hasValue)
+			gPacing.capFps = std::max(0.0, atof(argv[++i]));
+		else if (arg == "--render-lead" && hasValue)
+			gLowLatency.renderLeadMs = std::max(0.0, atof(argv[++i]));
+		else if (arg == "--sim-hz" && hasValue)
+			gSim.step = 1.0 / std::max(1.0, atof(argv[++i]));
+		else if (arg == "--assert-no-alloc")
+			gAllocGuard.failOnAlloc = true;
+		else if (arg == "--perf-counters")
+			gPerf.requested = true;
+		else if (arg == "--hud")
+			gHud.enabled = true;
+		else if (arg == "--debug")
+			gDebugLogs = true;
+		else
+			fprintf(stderr, "Ignoring unknown argument: %s\n", argv[i]);
+	}
 
-	// Use perspective projection
-	float fovyRad = (float)(90.0 / 180.0) * M_PI;
-	projectionMatrix = glm::perspective(fovyRad , w / (float)h, 1.0f, 100.0f);
+	if (gBenchmark.enabled && !gBenchmark.inputPath.empty() &&
+		!loadInputScript(gBenchmark.inputPath, gBenchmark.script))
+	{
+		fprintf(stderr, "Cannot find input script: %s\n", gBenchmark.inputPath.c_str());
+		exit(-1);
+	}
 
-	// Assume default camera position and orientation (camera is at
-	// (0, 0, 0) with looking at -z direction and its up vector pointing
-	// at +y direction)
-	//
-	// viewingMatrix = glm::mat4(1);
-	viewingMatrix = glm::lookAt(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0) + glm::vec3(0, 0, -1), glm::vec3(0, 1, 0));
-}
-void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
-    // Adjust the viewport when the window size changes
-    glViewport(0, 0, width, height);
+	if (gStress.enabled && (!gReplay.path.empty() || !gReplay.recordPath.empty()))
+	{
+		fprintf(stderr, "Ignoring --replay and --record; stress steps change the scene\n");
+		gReplay.path.clear();
+		gReplay.recordPath.clear();
+	}
+	if (!gReplay.path.empty())
+	{
+		if (!replayLoad(gReplay.path, gBenchmark.seed))
+		{
+			fprintf(stderr, "Cannot load replay: %s\n", gReplay.path.c_str());
+			exit(-1);
+		}
+		// The log is the input now, and keeps the game stepping to its end
+		gBenchmark.script.clear();
+		useMouseControls = false;
+		gPower.disabled = true;
+		if (gBenchmark.enabled && !framesSet)
+		{
+			long long left = gReplay.ticks - (gReplay.fastForward < 0 ? gReplay.ticks : gReplay.fastForward);
+			gBenchmark.frames = (int)std::max(1LL, left - gBenchmark.warmupFrames);
+		}
+	}
+	else if (gReplay.fastForward != 0)
+	{
+		fprintf(stderr, "Ignoring --fast-forward without --replay\n");
+		gReplay.fastForward = 0;
+	}
 }
 
-void cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
-{
-    if (!useMouseControls || gWidth <= 0) return;
-    const float t = static_cast<float>(xpos) / static_cast<float>(gWidth);
-    const float mapped = leftBound + t * (rightBound - leftBound);
-    translationX = clampf(mapped, leftBound, rightBound);
-}
-void keyboard(GLFWwindow *window, int key, int scancode, int action, int mods)
+// One iteration of the main loop. Returns false when the loop should stop.
+static bool runFrame(GLFWwindow *window)
 {
-	if (gDebugLogs) cout << translationX;
+	if (powerSkipFrame(gSim.view.gamefinish, !gRenderThread.active))
+	{
+		// The idle gap is neither game time to catch up, nor a late or long
+		// frame, nor latency for the input that arrived meanwhile
+		gSim.lastTime = -1.0;
+		gPacing.lastPresent = -1.0;
+		gHud.lastFrameTime = 0.0;
+		if (!gSim.threaded && powerHeld())
+			simulationDropHeldInput();
+		return !glfwWindowShouldClose(window);
+	}
+	renderDeadlineWait();
+	PROFILE_SCOPE("frame");
+	AllocCounters frameAllocs = tAllocs;
+	if (gBenchmark.enabled)
+		benchmarkFrameBegin(window);
+	bool measuring = gBenchmark.enabled && benchmarkMeasuring();
+	gAllocGuard.armed = gAllocGuard.failOnAlloc && measuring;
+	applyWindowEvents(window);
+	simulationFrame(gBenchmark.enabled);
+	gpuTimerBeginFrame(gBenchmark.enabled && benchmarkMeasuring());
+	renderStatsBeginFrame();
+	perfFrameBegin();
+
+	display();
+	gpuTimerEndFrame();
+	renderStatsEndFrame();
+
+	if (gBenchmark.enabled)
+		benchmarkFrameSubmitted();
 
-	if (key == GLFW_KEY_A )
-	{   isAPressed = (action == GLFW_PRESS || action == GLFW_REPEAT);
+	{
+		PROFILE_SCOPE("glfwSwapBuffers");
+		PERF_REGION(PERF_SWAP);
+		pacingBeforeSwap();
+		glfwSwapBuffers(window);
 	}
-	else if (key == GLFW_KEY_D )
-	{   isDPressed = (action == GLFW_PRESS || action == GLFW_REPEAT);
+	double presented = glfwGetTime();
+	int pacing = pacingFramePresented(presented);
+	if (measuring)
+		benchmarkFramePresented(pacing);
+	inputLatencyFramePresented(gSim.view, presented);
+	if (!gRenderThread.active)
+	{
+		PROFILE_SCOPE("glfwPollEvents");
+		PERF_REGION(PERF_EVENTS);
+		glfwPollEvents();
 	}
-	else if (key == GLFW_KEY_X )
-	{   isxPressed = (action == GLFW_PRESS || action == GLFW_REPEAT);
+	perfFrameEnd(measuring);
+	gAllocGuard.armed = false;
+	allocFrameEnd(frameAllocs, measuring);
+
+	if (gBenchmark.enabled && benchmarkFrameEnd())
+	{
+		if (gStress.enabled)
+		{
+			if (stressNextStep())
+				return true;
+			stressReport();
+			return false;
+		}
+		benchmarkReport();
+		return false;
 	}
-	else if (key == GLFW_KEY_R )
+	return !glfwWindowShouldClose(window);
+}
+
+static void renderThreadMain(GLFWwindow *window)
+{
+	profileSetThreadName("render");
+	glfwMakeContextCurrent(window);
+	// Counters follow the thread that opens them
+	if (gPerf.requested)
+		perfCountersInit();
+	while (runFrame(window))
 	{
-        obstacleIndex = rand() % 3;
-	    score=0;
-	    gamefinish=0;
-	    gWidth, gHeight;
-        leftBound= -4.5f;
-        rightBound= 3.0f;
-        translationX = -0.9f; // Initialize it to 0.0 initially
-        rotateX = -90;	   // Initialize it to 0.0 initially
-        rotateZ = 0;	   // Initialize it to 0.0 initially
-        speed= 0.45f;
-        isJumping = false;
-        up_down= true;
-        isAPressed = false;
-        isDPressed = false;
-        isxPressed=false;
-        jumpHeight = -6.2f; // Adjust the jump height as needed
-        jumpVelocity = -0.045f;
-        roadVelocity = +0.4f;
 	}
+	gpuTimerFlush();
+	glfwMakeContextCurrent(NULL);
+	gRenderThread.running.store(false, std::memory_order_release);
+	glfwPostEmptyEvent();
+}
+
+// Hands the context to a render thread and dispatches events until it stops
+void renderThreadRun(GLFWwindow *window)
+{
+	#ifndef __EMSCRIPTEN__
+	glfwMakeContextCurrent(NULL);
+	gRenderThread.active = true;
+	gLowLatency.queryCursor = false;
+	gRenderThread.running.store(true, std::memory_order_release);
+	gRenderThread.thread = std::thread(renderThreadMain, window);
+	while (gRenderThread.running.load(std::memory_order_acquire))
+	{
+		PROFILE_SCOPE("glfwWaitEvents");
+		glfwWaitEvents();
+	}
+	gRenderThread.thread.join();
+	gRenderThread.active = false;
+	glfwMakeContextCurrent(window);
+	#endif
 }
 
+#ifndef BUNNY_RUN_NO_MAIN
 int main(int argc, char **argv)
 {
+	parseArgs(argc, argv);
+	obstacleStreamSeed(gBenchmark.seed);   // --seed applies outside benchmarks too
+	if (!gReplay.recordPath.empty() && !replayRecordStart(gBenchmark.seed))
+		fprintf(stderr, "Cannot open replay log for writing: %s\n", gReplay.recordPath.c_str());
 
 	GLFWwindow *window;
 	if (!glfwInit())
@@ -1309,6 +6049,7 @@ int main(int argc, char **argv)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // This line is necessary for macOS
+	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, gGLDebug.requested ? GLFW_TRUE : GLFW_FALSE);
 	#endif
 
 	int width = 1000, height = 800;
@@ -1330,7 +6071,10 @@ int main(int argc, char **argv)
 	}
 
 	glfwMakeContextCurrent(window);
-	glfwSwapInterval(1);
+	pacingInit(gBenchmark.enabled);
+	// Low latency starts frames late enough to matter but early enough to make vsync
+	if (gLowLatency.renderLeadMs < 0.0)
+		gLowLatency.renderLeadMs = gLowLatency.lateLatch ? 6.0 : 0.0;
 
 	#ifndef __EMSCRIPTEN__
 	// Initialize GLEW to setup the OpenGL Function pointers
@@ -1341,6 +6085,8 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 	#endif
+	if (gGLDebug.requested)
+		glDebugInit();
     stbi_set_flip_vertically_on_load(true);
     // After initializing GLFW and GLEW
     bgTexture = loadTexture("sky.jpg");
@@ -1395,12 +6141,46 @@ int main(int argc, char **argv)
 
     init();
 
-    glfwSetKeyCallback(window, keyboard);
-    glfwSetCursorPosCallback(window, cursor_position_callback);
-    glfwSetWindowSizeCallback(window, reshape);
+    if (gReplay.fastForward != 0)
+    {
+        replayFastForward(gReplay.fastForward);
+        if (gReplay.fastForward < 0)
+        {
+            replayRecordFinish(gSim.steps);
+            glfwDestroyWindow(window);
+            glfwTerminate();
+            return gReplay.divergedAt >= 0 ? EXIT_FAILURE : 0;
+        }
+    }
+
+    if (!gBenchmark.enabled)
+    {
+        glfwSetKeyCallback(window, keyboard);
+        glfwSetCursorPosCallback(window, cursor_position_callback);
+        glfwSetWindowFocusCallback(window, window_focus_callback);
+        glfwSetWindowIconifyCallback(window, window_iconify_callback);
+        glfwSetWindowRefreshCallback(window, window_refresh_callback);
+        glfwSetWindowCloseCallback(window, window_close_callback);
+    }
+    glfwSetWindowSizeCallback(window, window_size_callback);
 	reshape(window, width, height); // Set up viewport and projection
 
-    checkGLError("inMain");
+    GL_CHECK("inMain");
+
+	if (gBenchmark.enabled || gGpuTimer.requested)
+		gpuTimerInit();
+	bool renderThread = !gBenchmark.enabled && !gRenderThread.disabled;
+	#ifdef __EMSCRIPTEN__
+	renderThread = false;
+	#endif
+	if (gPerf.requested && !renderThread)
+		perfCountersInit();
+	if (gBenchmark.enabled)
+		benchmarkInit();
+	if (gStress.enabled)
+		stressBegin();
+	if (!gBenchmark.enabled && !gSim.threadDisabled)
+		simulationStartThread();
 
 	#ifdef __EMSCRIPTEN__
 	struct LoopState {
@@ -1412,11 +6192,12 @@ int main(int argc, char **argv)
 		[](void *arg)
 		{
 			LoopState *s = reinterpret_cast<LoopState *>(arg);
-			display();
-			glfwSwapBuffers(s->window);
-			glfwPollEvents();
-			if (glfwWindowShouldClose(s->window))
+			if (!runFrame(s->window))
 			{
+				gpuTimerFlush();
+				replayRecordFinish(gSim.steps);
+				if (gProfilerEnabled)
+					writeChromeTrace(gTracePath);
 				emscripten_cancel_main_loop();
 			}
 		},
@@ -1425,17 +6206,25 @@ int main(int argc, char **argv)
 		true);
 	return 0;
 	#else
-	while (!glfwWindowShouldClose(window))
+	if (renderThread)
 	{
-
-        display();
-        glfwSwapBuffers(window);
-		glfwPollEvents();
-
+		renderThreadRun(window);
+	}
+	else
+	{
+		while (runFrame(window))
+		{
+		}
+		gpuTimerFlush();
 	}
+	simulationStopThread();
+	replayRecordFinish(gSim.steps);
+	if (gProfilerEnabled)
+		writeChromeTrace(gTracePath);
 	glfwDestroyWindow(window);
 	glfwTerminate();
 
-	return 0;
+	return gAllocGuard.violations > 0 ? EXIT_FAILURE : 0;
 	#endif
 }
+#endif // BUNNY_RUN_NO_MAIN
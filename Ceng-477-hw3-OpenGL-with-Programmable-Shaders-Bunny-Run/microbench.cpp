@@ -0,0 +1,547 @@
+// Micro-benchmarks for the loader, upload and per-frame CPU hot paths of
+// main.cpp. The game is compiled into this translation unit without its
+// main() so the real functions are timed, not copies of them.
+//
+//     make microbench
+//     ./microbench [--min-tris N] [--max-tris N] [--reps N] [--warmup N]
+//                  [--label TEXT] [--out result.json] [--keep-files]
+//
+// Synthetic grid meshes from 1K to 10M triangles are written next to the
+// binary, parsed, packed and uploaded. Results are JSON, one entry per
+// (function, mesh size), with min/median/mean/stddev/p95/max in ms.
+
+#define BUNNY_RUN_NO_MAIN
+#include "main.cpp"
+
+#include <chrono>
+
+struct MicroResult
+{
+	string name;
+	long long triangles;    // 0 for size-independent benchmarks
+	int warmup;
+	int reps;
+	vector<double> ms;
+	bool skipped;
+};
+
+static vector<MicroResult> gResults;
+
+// Per-frame benchmarks repeat one frame's work this many times per sample
+static const int kFramesPerRep = 1000;
+
+static double nowMs()
+{
+	using namespace std::chrono;
+	return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+template <class Fn>
+static void timeIt(const string &name, long long triangles, int warmup, int reps, Fn fn)
+{
+	MicroResult r;
+	r.name = name;
+	r.triangles = triangles;
+	r.warmup = warmup;
+	r.reps = reps;
+	r.skipped = false;
+
+	for (int i = 0; i < warmup; ++i)
+		fn();
+
+	r.ms.reserve(reps);
+	for (int i = 0; i < reps; ++i)
+	{
+		double t0 = nowMs();
+		fn();
+		r.ms.push_back(nowMs() - t0);
+	}
+
+	if (gDebugLogs)
+		fprintf(stderr, "%-24s %10lld tris  %d reps\n", name.c_str(), triangles, reps);
+	gResults.push_back(r);
+}
+
+static void skip(const string &name, long long triangles)
+{
+	MicroResult r;
+	r.name = name;
+	r.triangles = triangles;
+	r.warmup = 0;
+	r.reps = 0;
+	r.skipped = true;
+	gResults.push_back(r);
+}
+
+// Writes an n x n quad grid (2*n*n triangles) in the "f v//n" form ParseObj
+// expects, with a gentle height field so the bounds are non-trivial.
+static bool writeSyntheticObj(const string &fileName, int n)
+{
+	FILE *f = fopen(fileName.c_str(), "w");
+	if (!f)
+		return false;
+
+	for (int y = 0; y <= n; ++y)
+		for (int x = 0; x <= n; ++x)
+			fprintf(f, "v %f %f %f\n", x / (float)n, 0.05f * sinf(x * 0.1f) * cosf(y * 0.1f), y / (float)n);
+	for (int y = 0; y <= n; ++y)
+		for (int x = 0; x <= n; ++x)
+			fprintf(f, "vn 0.000000 1.000000 0.000000\n");
+	for (int y = 0; y < n; ++y)
+	{
+		for (int x = 0; x < n; ++x)
+		{
+			int a = y * (n + 1) + x + 1;
+			int b = a + 1;
+			int c = a + (n + 1);
+			int d = c + 1;
+			fprintf(f, "f %d//%d %d//%d %d//%d\n", a, a, c, c, b, b);
+			fprintf(f, "f %d//%d %d//%d %d//%d\n", b, b, c, c, d, d);
+		}
+	}
+
+	fclose(f);
+	return true;
+}
+
+static bool initBenchContext()
+{
+	if (!glfwInit())
+		return false;
+
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	GLFWwindow *window = glfwCreateWindow(64, 64, "microbench", NULL, NULL);
+	if (!window)
+		return false;
+
+	glfwMakeContextCurrent(window);
+	glewExperimental = GL_TRUE;
+	return glewInit() == GLEW_OK;
+}
+
+static void benchMesh(int n, int warmup, int reps, bool haveGL, bool keepFiles)
+{
+	long long triangles = 2LL * n * n;
+	string fileName = "microbench_" + std::to_string(triangles) + ".obj";
+	if (!writeSyntheticObj(fileName, n))
+	{
+		fprintf(stderr, "Cannot write %s\n", fileName.c_str());
+		return;
+	}
+
+	timeIt("ReadDataFromFile", triangles, warmup, reps, [&]() {
+		string data;
+		ReadDataFromFile(fileName, data);
+	});
+
+	vector<Vertex> vertices;
+	vector<Texture> textures;
+	vector<Normal> normals;
+	vector<Face> faces;
+	timeIt("ParseObj", triangles, warmup, reps, [&]() {
+		vertices.clear();
+		textures.clear();
+		normals.clear();
+		faces.clear();
+		ParseObj(fileName, vertices, textures, normals, faces);
+	});
+
+	TriangleBvh bvh;
+	timeIt("bvhBuild", triangles, warmup, reps, [&]() {
+		bvhBuild(bvh, vertices, faces);
+	});
+
+	// kFramesPerRep obstacle-sized boxes swept across the grid, through the
+	// BVH and, for the smaller meshes, against every triangle
+	glm::mat4 model(1.0f);
+	glm::vec3 half(0.02f, 0.1f, 0.02f);
+	volatile int sink = 0;
+	timeIt("collision.bvh", triangles, warmup, reps, [&]() {
+		for (int f = 0; f < kFramesPerRep; ++f)
+			sink = sink + bvhOverlapsBox(bvh, model, glm::vec3((f % 97) / 97.0f, 0.1f, (f % 89) / 89.0f), half);
+	});
+	if (triangles < 1000000)
+	{
+		timeIt("collision.triangles", triangles, warmup, reps, [&]() {
+			for (int f = 0; f < kFramesPerRep; ++f)
+			{
+				glm::vec3 centre((f % 97) / 97.0f, 0.1f, (f % 89) / 89.0f);
+				bool hit = false;
+				for (size_t t = 0; t < faces.size() && !hit; ++t)
+				{
+					glm::vec3 p[3];
+					for (int k = 0; k < 3; ++k)
+					{
+						const Vertex &v = vertices[faces[t].vIndex[k]];
+						p[k] = glm::vec3(v.x, v.y, v.z) - centre;
+					}
+					hit = triangleOverlapsBox(p[0], p[1], p[2], half);
+				}
+				sink = sink + hit;
+			}
+		});
+	}
+	else
+	{
+		skip("collision.triangles", triangles);
+	}
+
+	vector<GLfloat> vertexData(vertices.size() * 3);
+	vector<GLfloat> normalData(normals.size() * 3);
+	vector<GLuint> indexData(faces.size() * 3);
+	timeIt("initVBO.pack", triangles, warmup, reps, [&]() {
+		PackMeshData(vertices, normals, faces, vertexData.data(), normalData.data(), indexData.data());
+	});
+
+	if (haveGL)
+	{
+		timeIt("initVBO", triangles, warmup, reps, [&]() {
+			GLuint meshVao, vbo, ibo;
+			int vertexBytes, normalBytes;
+			initVBO(meshVao, vbo, ibo, vertexBytes, normalBytes, vertices, textures, normals, faces);
+			glFinish();
+			glDeleteBuffers(1, &vbo);
+			glDeleteBuffers(1, &ibo);
+			glDeleteVertexArrays(1, &meshVao);
+		});
+	}
+	else
+	{
+		skip("initVBO", triangles);
+	}
+
+	if (!keepFiles)
+		remove(fileName.c_str());
+}
+
+// sweptObstacleHits' exact test for one obstacle given by lane and tile: the
+// bunny's path from b0 to b1 relative to the obstacle, over a tick that
+// scrolled the road by travel up to scroll, against the summed half extents
+static bool pathHitsObstacle(glm::vec2 b0, glm::vec2 b1, int lane, int tile, float scroll, float travel, glm::vec2 half)
+{
+	glm::mat4 o = obstacleMatrix(lane, tile, scroll - travel);
+	float length = trackLength();
+	float dz = fmod(b0.y - o[3][2] + half.y, length);
+	if (dz < 0)
+		dz += length;
+	dz -= half.y;
+	return segmentHitsBox(glm::vec2(b0.x - o[3][0], dz), glm::vec2(b1.x - o[3][0], dz - travel), half);
+}
+
+// The table query sweptObstacleHits makes for that path
+template <class Fn>
+static void pathObstaclesNear(glm::vec2 b0, glm::vec2 b1, float scroll, float travel, glm::vec2 half, Fn fn)
+{
+	float reach = std::max(half.x + fabs(b1.x - b0.x) / 2, half.y + travel / 2);
+	obstaclesNear((b0.x + b1.x) / 2, b1.y, reach, scroll - travel / 2, fn);
+}
+
+// The table must hand back every obstacle the full scan finds a path hit
+// for: random paths, boxes and tick lengths on random layouts. Prints the
+// first mismatch and returns false if there is any.
+static bool checkCollisionTable()
+{
+	int savedLanes = gLaneCount, savedTiles = gTileCount, savedStride = gObstacleRowStride;
+	vector<int> scan, table;
+	long long queries = 0, hits = 0;
+	bool ok = true;
+	for (unsigned layout = 0; layout < 100 && ok; ++layout)
+	{
+		gLaneCount = 2 + (int)(streamRandom(layout, 0) % 63);
+		gTileCount = 1 + (int)(streamRandom(layout, 1) % 120);
+		gObstacleRowStride = (int)(streamRandom(layout, 2) % 4);
+		float length = trackLength();
+		for (unsigned q = 0; q < 200 && ok; ++q, ++queries)
+		{
+			auto uniform = [&](unsigned k) { return (float)(streamRandom(layout, 16 + 8 * q + k) >> 40) / (1 << 24); };
+			float travel = uniform(0) * 4.0f;
+			float scroll = uniform(1) * 8.0f * length;
+			glm::vec2 half(0.3f + 1.5f * uniform(2), 0.3f + 1.5f * uniform(3));
+			glm::vec2 b0(-6.0f + uniform(4) * 3.0f * gLaneCount, -uniform(5) * length);
+			glm::vec2 b1(b0.x + 2.0f * uniform(6) - 1.0f, b0.y);
+
+			scan.clear();
+			table.clear();
+			for (int i = 0; i < gLaneCount - 1; ++i)
+				for (int j = 0; j < gTileCount; ++j)
+					if (isObstacleRow(j) && pathHitsObstacle(b0, b1, i, j, scroll, travel, half))
+						scan.push_back(i * gTileCount + j);
+			pathObstaclesNear(b0, b1, scroll, travel, half, [&](int i, int j) {
+				if (pathHitsObstacle(b0, b1, i, j, scroll, travel, half))
+					table.push_back(i * gTileCount + j);
+			});
+			std::sort(table.begin(), table.end());
+			hits += scan.size();
+			if (scan != table)
+			{
+				fprintf(stderr, "collision table: %zu hits, scan %zu (lanes %d tiles %d stride %d, query %u)\n",
+						table.size(), scan.size(), gLaneCount, gTileCount, gObstacleRowStride, q);
+				ok = false;
+			}
+		}
+	}
+	if (gDebugLogs && ok)
+		fprintf(stderr, "collision table matches the scan: %lld queries, %lld hits\n", queries, hits);
+	gLaneCount = savedLanes;
+	gTileCount = savedTiles;
+	gObstacleRowStride = savedStride;
+	return ok;
+}
+
+static void benchFrame(int warmup, int reps)
+{
+	// One frame's worth of the matrix work display() does: the bunny, every
+	// road tile and the three obstacles on row 15.
+	volatile float sink = 0;
+
+	timeIt("display.matrices", 0, warmup, reps, [&]() {
+		for (int f = 0; f < kFramesPerRep; ++f)
+		{
+			roadVelocity += 0.01f;
+			glm::mat4 m = bunnyModelingMatrix();
+			for (int i = 0; i < 4; ++i)
+				for (int j = 0; j < 30; ++j)
+					m[3] += roadTileMatrix(i, j)[3];
+			for (int i = 0; i < 3; ++i)
+				m[3] += obstacleMatrix(i, 15)[3];
+			sink = sink + m[3][2];
+		}
+	});
+
+	// The game's collide system for the default scene: the obstacle stream
+	// and scroll system place the pool, then the bunny's path is swept
+	// against it, once per tick
+	glm::mat4 bunny = bunnyModelingMatrix();
+	float scroll = 0.4f;
+	gSweep.valid = false;
+	timeIt("collision.swept", 0, warmup, reps, [&]() {
+		EntityStore &pool = gObstacleStream.pool;
+		for (int f = 0; f < kFramesPerRep; ++f)
+		{
+			scroll += 0.37f;
+			bunny[3][0] = -3.5f + (f % 75) * 0.1f;
+			obstacleStreamAdvance(scroll);
+			entityScroll(pool, 0, pool.count, scroll);
+			int hits = 0;
+			sweptObstacleHits(bunny, scroll, [&](int, bool) { hits++; });
+			sink = sink + hits;
+		}
+	});
+
+	// A tick's path test against ~1900 obstacles (64 lanes, every tile), by
+	// scanning them all and through the lane/track table
+	int savedLanes = gLaneCount, savedStride = gObstacleRowStride;
+	gLaneCount = 64;
+	gObstacleRowStride = 1;
+
+	const float travel = 0.37f;
+	const glm::vec2 half(1.0f, 1.0f);
+	timeIt("collision.scan", 0, warmup, reps, [&]() {
+		for (int f = 0; f < kFramesPerRep; ++f)
+		{
+			glm::vec2 b0(-3.5f + (f % 75) * 0.1f, bunny[3][2]), b1(b0.x + 0.05f, b0.y);
+			int hits = 0;
+			for (int i = 0; i < gLaneCount - 1; ++i)
+				for (int j = 0; j < gTileCount; ++j)
+					if (isObstacleRow(j))
+						hits += pathHitsObstacle(b0, b1, i, j, f * travel, travel, half);
+			sink = sink + hits;
+		}
+	});
+
+	timeIt("collision.table", 0, warmup, reps, [&]() {
+		for (int f = 0; f < kFramesPerRep; ++f)
+		{
+			glm::vec2 b0(-3.5f + (f % 75) * 0.1f, bunny[3][2]), b1(b0.x + 0.05f, b0.y);
+			int hits = 0;
+			pathObstaclesNear(b0, b1, f * travel, travel, half, [&](int i, int j) {
+				hits += pathHitsObstacle(b0, b1, i, j, f * travel, travel, half);
+			});
+			sink = sink + hits;
+		}
+	});
+
+	// Placing and listing ~38000 road tiles and obstacles (64 lanes, 300
+	// tiles, every tile an obstacle row): the per-object matrix loops
+	// display() used to run against the entity systems
+	int savedTiles = gTileCount;
+	gTileCount = 300;
+	RenderState view = captureRenderState();
+	timeIt("scene.loops", 0, warmup, reps, [&]() {
+		view.roadVelocity += 0.37f;
+		glm::vec4 acc(0.0f);
+		for (int i = 0; i < gLaneCount; ++i)
+			for (int j = 0; j < gTileCount; ++j)
+				acc += roadTileMatrix(i, j, view.roadVelocity)[3];
+		for (int i = 0; i < gLaneCount - 1; ++i)
+			for (int j = 0; j < gTileCount; ++j)
+				if (isObstacleRow(j) && (obstacleBonusLane(view.obstacleKey, j, view.roadVelocity) == i ||
+										 view.gamefinish == 0 || view.variable != i))
+					acc += obstacleMatrix(i, j, view.roadVelocity)[3];
+		sink = sink + acc.z;
+	});
+	timeIt("scene.systems", 0, warmup, reps, [&]() {
+		view.roadVelocity += 0.37f;
+		sceneUpdate(view);
+		glm::vec4 acc(0.0f);
+		for (int k = 0; k < gScene.passStart[SCENE_PASS_COUNT]; ++k)
+			acc += entityMatrix(gScene.store, gScene.renderList[k])[3];
+		sink = sink + acc.z;
+	});
+
+	// Model and MVP matrices for the same render list, one glm translate,
+	// scale and two full matrix products per entity against the batch kernel
+	const EntityStore &store = gScene.store;
+	const int *list = gScene.renderList.data();
+	int listSize = gScene.passStart[SCENE_PASS_COUNT];
+	vector<float> models(16 * listSize), mvps(16 * listSize);
+	glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 1.25f, 1.0f, 100.0f) * glm::mat4(1.0f);
+	timeIt("transform.glm", 0, warmup, reps, [&]() {
+		for (int k = 0; k < listSize; ++k)
+		{
+			int e = list[k];
+			glm::mat4 m = glm::translate(glm::mat4(1.0f), glm::vec3(store.posX[e], store.posY[e], store.posZ[e])) *
+						  glm::scale(glm::mat4(1.0f), glm::vec3(store.scaleX[e], store.scaleY[e], store.scaleZ[e]));
+			glm::mat4 mvp = viewProjection * m;
+			memcpy(&models[16 * k], glm::value_ptr(m), sizeof(m));
+			memcpy(&mvps[16 * k], glm::value_ptr(mvp), sizeof(mvp));
+		}
+		sink = sink + mvps[16 * listSize - 2];
+	});
+	timeIt("transform.batch", 0, warmup, reps, [&]() {
+		transformBatch(store, list, listSize, models.data(), &viewProjection, mvps.data());
+		sink = sink + mvps[16 * listSize - 2];
+	});
+
+	gLaneCount = savedLanes;
+	gObstacleRowStride = savedStride;
+	gTileCount = savedTiles;
+}
+
+static void writeResults(FILE *out, const string &label)
+{
+	fprintf(out, "{\n");
+	fprintf(out, "  \"suite\": \"bunny-run-microbench\",\n");
+	fprintf(out, "  \"label\": \"%s\",\n", label.c_str());
+	fprintf(out, "  \"unit\": \"ms\",\n");
+	fprintf(out, "  \"display_frames_per_rep\": %d,\n", kFramesPerRep);
+	fprintf(out, "  \"results\": [\n");
+	for (size_t k = 0; k < gResults.size(); ++k)
+	{
+		const MicroResult &r = gResults[k];
+		const char *sep = k + 1 < gResults.size() ? "," : "";
+		if (r.skipped)
+		{
+			fprintf(out, "    {\"name\": \"%s\", \"triangles\": %lld, \"skipped\": true}%s\n",
+					r.name.c_str(), r.triangles, sep);
+			continue;
+		}
+
+		vector<double> sorted = r.ms;
+		std::sort(sorted.begin(), sorted.end());
+		double mean = 0;
+		for (double v : sorted)
+			mean += v;
+		mean /= sorted.size();
+		double var = 0;
+		for (double v : sorted)
+			var += (v - mean) * (v - mean);
+		double stddev = sorted.size() > 1 ? sqrt(var / (sorted.size() - 1)) : 0.0;
+		size_t mid = sorted.size() / 2;
+		double median = sorted.size() % 2 ? sorted[mid] : 0.5 * (sorted[mid - 1] + sorted[mid]);
+		size_t p95 = (size_t)ceil(0.95 * sorted.size());
+
+		fprintf(out, "    {\"name\": \"%s\", \"triangles\": %lld, \"warmup\": %d, \"reps\": %d, "
+					 "\"min\": %.6f, \"median\": %.6f, \"mean\": %.6f, \"stddev\": %.6f, \"p95\": %.6f, \"max\": %.6f}%s\n",
+				r.name.c_str(), r.triangles, r.warmup, r.reps,
+				sorted.front(), median, mean, stddev, sorted[std::max<size_t>(p95, 1) - 1], sorted.back(), sep);
+	}
+	fprintf(out, "  ]\n");
+	fprintf(out, "}\n");
+}
+
+int main(int argc, char **argv)
+{
+	long long minTris = 1000;
+	long long maxTris = 10000000;
+	int reps = 10;
+	int warmup = 2;
+	bool keepFiles = false;
+	string label;
+	string outputPath;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+		bool hasValue = i + 1 < argc;
+		if (arg == "--min-tris" && hasValue)
+			minTris = atoll(argv[++i]);
+		else if (arg == "--max-tris" && hasValue)
+			maxTris = atoll(argv[++i]);
+		else if (arg == "--reps" && hasValue)
+			reps = std::max(1, atoi(argv[++i]));
+		else if (arg == "--warmup" && hasValue)
+			warmup = std::max(0, atoi(argv[++i]));
+		else if (arg == "--label" && hasValue)
+			label = argv[++i];
+		else if (arg == "--out" && hasValue)
+			outputPath = argv[++i];
+		else if (arg == "--keep-files")
+			keepFiles = true;
+		else if (arg == "--debug")
+			gDebugLogs = true;
+		else
+			fprintf(stderr, "Ignoring unknown argument: %s\n", argv[i]);
+	}
+
+	bool haveGL = initBenchContext();
+	if (!haveGL)
+		fprintf(stderr, "No OpenGL context; GL benchmarks are skipped\n");
+
+	if (!checkCollisionTable())
+		return EXIT_FAILURE;
+	benchFrame(warmup, reps);
+
+	if (haveGL)
+	{
+		stbi_set_flip_vertically_on_load(true);
+		timeIt("loadTexture", 0, warmup, reps, [&]() {
+			GLuint tex = loadTexture("sky.jpg");
+			glFinish();
+			glDeleteTextures(1, &tex);
+		});
+	}
+	else
+	{
+		skip("loadTexture", 0);
+	}
+
+	// 1K, 10K, ... 10M triangles. Million-triangle meshes take seconds per
+	// parse, so they get fewer repetitions.
+	for (long long target = 1000; target <= maxTris; target *= 10)
+	{
+		if (target < minTris)
+			continue;
+		int n = (int)ceil(sqrt(target / 2.0));
+		bool large = target >= 1000000;
+		benchMesh(n, large ? std::min(warmup, 1) : warmup, large ? std::min(reps, 3) : reps, haveGL, keepFiles);
+	}
+
+	FILE *out = stdout;
+	if (!outputPath.empty() && !(out = fopen(outputPath.c_str(), "w")))
+	{
+		fprintf(stderr, "Cannot open %s\n", outputPath.c_str());
+		out = stdout;
+	}
+	writeResults(out, label);
+	if (out != stdout)
+		fclose(out);
+
+	if (haveGL)
+		glfwTerminate();
+	return 0;
+}
@@ -0,0 +1,462 @@
+// Performance regression gate for benchmark results.
+//
+//     make perfcompare
+//     ./perfcompare baseline.json candidate.json [--tol <metric>=<percent>]...
+//                   [--tol-default <percent>] [--confidence <0..1>]
+//
+// Each file holds one or more runs of `main --benchmark`, `--stress` or
+// `microbench` output: a single JSON object, an array of them, or several
+// objects appended one after another (`./main --benchmark >> base.json`).
+// Every timing and memory metric is reduced to the median over runs. A metric
+// regresses when the candidate median is worse than the baseline by more
+// than its tolerance and, with two or more runs per side, the bootstrap
+// confidence interval of the difference lies entirely above zero.
+//
+// Exit status: 0 = no regression, 1 = regression, 2 = bad input.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+using namespace std;
+
+// ---------------------------------------------------------------------------
+// Minimal JSON reader: numeric leaves are flattened into dotted keys. Arrays
+// of objects are keyed by their "name" (+ "@triangles") or "axis=value"
+// fields so runs with the same layout line up.
+// ---------------------------------------------------------------------------
+
+typedef map<string, double> Metrics;
+
+struct JsonReader
+{
+	const string &text;
+	size_t pos;
+	bool ok;
+
+	JsonReader(const string &t) : text(t), pos(0), ok(true) {}
+
+	void skipSpace()
+	{
+		while (pos < text.size() && isspace((unsigned char)text[pos]))
+			++pos;
+	}
+
+	bool atEnd()
+	{
+		skipSpace();
+		return pos >= text.size();
+	}
+
+	bool expect(char c)
+	{
+		skipSpace();
+		if (pos < text.size() && text[pos] == c)
+		{
+			++pos;
+			return true;
+		}
+		ok = false;
+		return false;
+	}
+
+	string readString()
+	{
+		string s;
+		if (!expect('"'))
+			return s;
+		while (pos < text.size() && text[pos] != '"')
+		{
+			if (text[pos] == '\\' && pos + 1 < text.size())
+				++pos;
+			s += text[pos++];
+		}
+		++pos;
+		return s;
+	}
+
+	// Parses one value. Numbers and strings found directly inside an object
+	// are also returned through `scalar` so array elements can be keyed.
+	void readValue(const string &prefix, Metrics &out, string *scalar)
+	{
+		skipSpace();
+		if (pos >= text.size())
+		{
+			ok = false;
+			return;
+		}
+
+		char c = text[pos];
+		if (c == '{')
+		{
+			++pos;
+			skipSpace();
+			if (pos < text.size() && text[pos] == '}')
+			{
+				++pos;
+				return;
+			}
+			while (ok)
+			{
+				string key = readString();
+				expect(':');
+				readValue(prefix.empty() ? key : prefix + "." + key, out, NULL);
+				skipSpace();
+				if (pos < text.size() && text[pos] == ',')
+				{
+					++pos;
+					continue;
+				}
+				expect('}');
+				break;
+			}
+		}
+		else if (c == '[')
+		{
+			++pos;
+			skipSpace();
+			if (pos < text.size() && text[pos] == ']')
+			{
+				++pos;
+				return;
+			}
+			for (int index = 0; ok; ++index)
+			{
+				Metrics element;
+				readValue("", element, NULL);
+				string key = elementKey(element, index);
+				for (Metrics::iterator it = element.begin(); it != element.end(); ++it)
+					out[prefix + "." + key + "." + it->first] = it->second;
+				skipSpace();
+				if (pos < text.size() && text[pos] == ',')
+				{
+					++pos;
+					continue;
+				}
+				expect(']');
+				break;
+			}
+		}
+		else if (c == '"')
+		{
+			string s = readString();
+			// Keep identifying strings so elementKey() can use them
+			out["#" + prefix] = 0;
+			out["#" + prefix + "=" + s] = 0;
+			if (scalar)
+				*scalar = s;
+		}
+		else if (isdigit((unsigned char)c) || c == '-')
+		{
+			char *end = NULL;
+			double v = strtod(text.c_str() + pos, &end);
+			pos = end - text.c_str();
+			out[prefix] = v;
+		}
+		else
+		{
+			// true / false / null
+			while (pos < text.size() && isalpha((unsigned char)text[pos]))
+				++pos;
+		}
+	}
+
+	static string findString(const Metrics &m, const string &field)
+	{
+		string tag = "#" + field + "=";
+		Metrics::const_iterator it = m.lower_bound(tag);
+		if (it != m.end() && it->first.compare(0, tag.size(), tag) == 0)
+			return it->first.substr(tag.size());
+		return "";
+	}
+
+	static string elementKey(Metrics &m, int index)
+	{
+		char buf[64];
+		string name = findString(m, "name");
+		if (!name.empty())
+		{
+			if (m.count("triangles") && m["triangles"] > 0)
+			{
+				snprintf(buf, sizeof(buf), "@%.0f", m["triangles"]);
+				name += buf;
+			}
+			return name;
+		}
+		string axis = findString(m, "axis");
+		if (!axis.empty() && m.count("value"))
+		{
+			snprintf(buf, sizeof(buf), "=%.0f", m["value"]);
+			return axis + buf;
+		}
+		snprintf(buf, sizeof(buf), "%d", index);
+		return buf;
+	}
+};
+
+static bool loadRuns(const char *fileName, vector<Metrics> &runs)
+{
+	ifstream file(fileName);
+	if (!file.is_open())
+	{
+		fprintf(stderr, "Cannot open %s\n", fileName);
+		return false;
+	}
+	stringstream buffer;
+	buffer << file.rdbuf();
+	string text = buffer.str();
+
+	JsonReader reader(text);
+	while (reader.ok && !reader.atEnd())
+	{
+		if (text[reader.pos] == '[')
+		{
+			// An array of runs
+			Metrics wrapped;
+			reader.readValue("runs", wrapped, NULL);
+			map<string, Metrics> byRun;
+			for (Metrics::iterator it = wrapped.begin(); it != wrapped.end(); ++it)
+			{
+				size_t start = it->first.find('.');
+				size_t end = it->first.find('.', start + 1);
+				if (start == string::npos || end == string::npos)
+					continue;
+				byRun[it->first.substr(start + 1, end - start - 1)][it->first.substr(end + 1)] = it->second;
+			}
+			for (map<string, Metrics>::iterator it = byRun.begin(); it != byRun.end(); ++it)
+				runs.push_back(it->second);
+		}
+		else
+		{
+			Metrics run;
+			reader.readValue("", run, NULL);
+			runs.push_back(run);
+		}
+	}
+
+	if (!reader.ok || runs.empty())
+	{
+		fprintf(stderr, "Cannot parse %s near offset %zu\n", fileName, reader.pos);
+		return false;
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+// Metrics, tolerances and statistics
+// ---------------------------------------------------------------------------
+
+// Default tolerance (percent) by the last key component; metrics not listed
+// here are identifiers or sample counts and are not compared. Tails get more
+// room than medians because they are noisier.
+static bool defaultTolerance(const string &key, double &tolerance)
+{
+	size_t dot = key.rfind('.');
+	string leaf = dot == string::npos ? key : key.substr(dot + 1);
+
+	static const struct { const char *leaf; double tolerance; } kDefaults[] = {
+		{"p50", 5}, {"median", 5}, {"mean", 5}, {"min", 5},
+		{"p95", 10}, {"p99", 15}, {"max", 25},
+		{"startup_ms", 10},
+		{"rss_bytes", 5}, {"peak_rss_bytes", 5}, {"mesh_bytes", 0},
+		{"draw_calls_per_frame", 0}, {"triangles_per_frame", 0},
+	};
+	for (size_t i = 0; i < sizeof(kDefaults) / sizeof(kDefaults[0]); ++i)
+	{
+		if (leaf == kDefaults[i].leaf)
+		{
+			tolerance = kDefaults[i].tolerance;
+			return true;
+		}
+	}
+	return false;
+}
+
+static double median(vector<double> v)
+{
+	std::sort(v.begin(), v.end());
+	size_t mid = v.size() / 2;
+	return v.size() % 2 ? v[mid] : 0.5 * (v[mid - 1] + v[mid]);
+}
+
+// Deterministic xorshift so the gate gives the same answer on every run
+static unsigned int gRandomState = 2463534242u;
+static unsigned int nextRandom()
+{
+	gRandomState ^= gRandomState << 13;
+	gRandomState ^= gRandomState >> 17;
+	gRandomState ^= gRandomState << 5;
+	return gRandomState;
+}
+
+// Percentile bootstrap interval for median(candidate) - median(baseline)
+static void bootstrapInterval(const vector<double> &base, const vector<double> &cand, double confidence,
+							  double &low, double &high)
+{
+	const int kResamples = 2000;
+	vector<double> diffs;
+	diffs.reserve(kResamples);
+	vector<double> b(base.size()), c(cand.size());
+	for (int r = 0; r < kResamples; ++r)
+	{
+		for (size_t i = 0; i < b.size(); ++i)
+			b[i] = base[nextRandom() % base.size()];
+		for (size_t i = 0; i < c.size(); ++i)
+			c[i] = cand[nextRandom() % cand.size()];
+		diffs.push_back(median(c) - median(b));
+	}
+	std::sort(diffs.begin(), diffs.end());
+	double tail = (1.0 - confidence) / 2.0;
+	low = diffs[(size_t)(tail * (kResamples - 1))];
+	high = diffs[(size_t)((1.0 - tail) * (kResamples - 1))];
+}
+
+static vector<double> collect(const vector<Metrics> &runs, const string &key)
+{
+	vector<double> values;
+	for (size_t i = 0; i < runs.size(); ++i)
+	{
+		Metrics::const_iterator it = runs[i].find(key);
+		if (it != runs[i].end())
+			values.push_back(it->second);
+	}
+	return values;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: perfcompare <baseline.json> <candidate.json> [--tol <metric>=<percent>]... "
+					"[--tol-default <percent>] [--confidence <0..1>] [--all]\n");
+}
+
+int main(int argc, char **argv)
+{
+	vector<const char *> files;
+	map<string, double> tolerances;
+	double toleranceOverride = -1;
+	double confidence = 0.95;
+	bool showAll = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg(argv[i]);
+		bool hasValue = i + 1 < argc;
+		if (arg == "--tol" && hasValue)
+		{
+			string spec(argv[++i]);
+			size_t eq = spec.find('=');
+			if (eq == string::npos)
+			{
+				usage();
+				return 2;
+			}
+			tolerances[spec.substr(0, eq)] = atof(spec.c_str() + eq + 1);
+		}
+		else if (arg == "--tol-default" && hasValue)
+			toleranceOverride = atof(argv[++i]);
+		else if (arg == "--confidence" && hasValue)
+			confidence = std::min(0.999, std::max(0.5, atof(argv[++i])));
+		else if (arg == "--all")
+			showAll = true;
+		else if (arg[0] != '-')
+			files.push_back(argv[i]);
+		else
+		{
+			usage();
+			return 2;
+		}
+	}
+	if (files.size() != 2)
+	{
+		usage();
+		return 2;
+	}
+
+	vector<Metrics> baseRuns, candRuns;
+	if (!loadRuns(files[0], baseRuns) || !loadRuns(files[1], candRuns))
+		return 2;
+
+	printf("baseline:  %s (%zu run%s)\n", files[0], baseRuns.size(), baseRuns.size() == 1 ? "" : "s");
+	printf("candidate: %s (%zu run%s)\n\n", files[1], candRuns.size(), candRuns.size() == 1 ? "" : "s");
+	printf("%-44s %12s %12s %9s %7s  %-19s %s\n", "metric", "baseline", "candidate", "delta", "tol", "CI (delta)", "status");
+
+	bool useInterval = baseRuns.size() >= 2 && candRuns.size() >= 2;
+	int regressions = 0, improvements = 0, compared = 0;
+
+	for (Metrics::const_iterator it = baseRuns[0].begin(); it != baseRuns[0].end(); ++it)
+	{
+		const string &key = it->first;
+		if (key[0] == '#')
+			continue;
+
+		double tolerance;
+		if (!defaultTolerance(key, tolerance))
+			continue;
+		if (toleranceOverride >= 0 && tolerance > 0)
+			tolerance = toleranceOverride;
+		// --tol matches the full key or any dotted suffix of it
+		for (map<string, double>::iterator t = tolerances.begin(); t != tolerances.end(); ++t)
+		{
+			const string &k = t->first;
+			if (key == k || (key.size() > k.size() && key.compare(key.size() - k.size(), k.size(), k) == 0 &&
+							 key[key.size() - k.size() - 1] == '.'))
+				tolerance = t->second;
+		}
+
+		vector<double> base = collect(baseRuns, key);
+		vector<double> cand = collect(candRuns, key);
+		if (base.empty() || cand.empty())
+			continue;
+		++compared;
+
+		double mb = median(base);
+		double mc = median(cand);
+		double delta = mc - mb;
+		double deltaPct = mb != 0 ? 100.0 * delta / fabs(mb) : (delta != 0 ? 100.0 : 0.0);
+
+		char interval[32] = "-";
+		bool significant = true;
+		bool improvedSignificantly = true;
+		if (useInterval)
+		{
+			double low, high;
+			bootstrapInterval(base, cand, confidence, low, high);
+			double scale = mb != 0 ? 100.0 / fabs(mb) : 0.0;
+			snprintf(interval, sizeof(interval), "[%+.1f%%, %+.1f%%]", low * scale, high * scale);
+			significant = low > 0;
+			improvedSignificantly = high < 0;
+		}
+
+		const char *status = "ok";
+		if (deltaPct > tolerance && significant)
+		{
+			status = "REGRESSION";
+			++regressions;
+		}
+		else if (deltaPct < -tolerance && improvedSignificantly)
+		{
+			status = "improved";
+			++improvements;
+		}
+		else if (!showAll)
+		{
+			if (fabs(deltaPct) < 0.05)
+				continue;
+		}
+
+		printf("%-44s %12.4f %12.4f %+8.1f%% %6.1f%%  %-19s %s\n",
+			   key.c_str(), mb, mc, deltaPct, tolerance, interval, status);
+	}
+
+	printf("\n%d metrics compared, %d regression%s, %d improvement%s%s\n", compared, regressions,
+		   regressions == 1 ? "" : "s", improvements, improvements == 1 ? "" : "s",
+		   useInterval ? "" : " (single run per side: tolerance only, no confidence interval)");
+	return regressions > 0 ? 1 : 0;
+}
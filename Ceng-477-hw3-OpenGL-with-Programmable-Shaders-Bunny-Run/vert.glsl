@@ -13,7 +13,11 @@ vec3 ka = vec3(0.3, 0.3, 0.3);   // ambient reflectance coefficient
 vec3 ks = vec3(0.8, 0.8, 0.8);   // specular reflectance coefficient
 vec3 lightPos = vec3(5, 5, 5);   // light position in world coordinates
 
-uniform mat4 modelingMatrix;
+// Written right before the bunny's draw so it can be latched late
+layout(std140) uniform BunnyTransform
+{
+	mat4 modelingMatrix;
+};
 uniform mat4 viewingMatrix;
 uniform mat4 projectionMatrix;
 uniform vec3 eyePos;